@@ -0,0 +1,88 @@
+#include <benchmark/benchmark.h>
+#include <event2/util.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "quic/connection_table.h"
+
+namespace quic_tunnel {
+namespace {
+
+std::vector<ConnectionId> RandomIds(size_t count) {
+  std::vector<ConnectionId> ids(count);
+  for (auto &id : ids) {
+    evutil_secure_rng_get_bytes(id.data(), id.size());
+  }
+  return ids;
+}
+
+void BM_ConnectionTableFind(benchmark::State &state) {
+  auto ids = RandomIds(state.range(0));
+  ConnectionTable<std::unique_ptr<int>> table;
+  for (const auto &id : ids) {
+    table.Emplace(id, std::make_unique<int>());
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(table.Find(ids[i]));
+    i = i + 1 == ids.size() ? 0 : i + 1;
+  }
+}
+
+void BM_MapFind(benchmark::State &state) {
+  auto ids = RandomIds(state.range(0));
+  std::map<ConnectionId, std::unique_ptr<int>> map;
+  for (const auto &id : ids) {
+    map.emplace(id, std::make_unique<int>());
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.find(ids[i]));
+    i = i + 1 == ids.size() ? 0 : i + 1;
+  }
+}
+
+// Replaces one connection per iteration, so the table size stays constant.
+void BM_ConnectionTableChurn(benchmark::State &state) {
+  auto ids = RandomIds(state.range(0));
+  ConnectionTable<std::unique_ptr<int>> table;
+  for (const auto &id : ids) {
+    table.Emplace(id, std::make_unique<int>());
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    table.Erase(ids[i]);
+    evutil_secure_rng_get_bytes(ids[i].data(), ids[i].size());
+    table.Emplace(ids[i], std::make_unique<int>());
+    i = i + 1 == ids.size() ? 0 : i + 1;
+  }
+}
+
+void BM_MapChurn(benchmark::State &state) {
+  auto ids = RandomIds(state.range(0));
+  std::map<ConnectionId, std::unique_ptr<int>> map;
+  for (const auto &id : ids) {
+    map.emplace(id, std::make_unique<int>());
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    map.erase(ids[i]);
+    evutil_secure_rng_get_bytes(ids[i].data(), ids[i].size());
+    map.emplace(ids[i], std::make_unique<int>());
+    i = i + 1 == ids.size() ? 0 : i + 1;
+  }
+}
+
+BENCHMARK(BM_ConnectionTableFind)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_MapFind)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_ConnectionTableChurn)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_MapChurn)->RangeMultiplier(10)->Range(1000, 1000000);
+
+}  // namespace
+}  // namespace quic_tunnel
@@ -0,0 +1,72 @@
+#include <benchmark/benchmark.h>
+#include <event2/buffer.h>
+
+#include <string>
+#include <string_view>
+
+#include "http_request_host_parser.h"
+#include "util.h"
+
+namespace quic_tunnel {
+namespace {
+
+constexpr std::string_view kOriginFormRequest =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: curl/7.68.0\r\n"
+    "Accept: */*\r\n\r\n";
+
+constexpr std::string_view kAbsoluteFormRequest =
+    "GET http://www.example.com/index.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: curl/7.68.0\r\n"
+    "Accept: */*\r\n\r\n";
+
+constexpr std::string_view kConnectRequest =
+    "CONNECT www.example.com:443 HTTP/1.1\r\n"
+    "Host: www.example.com:443\r\n\r\n";
+
+// Adds request to evb in chunks of chunk bytes, each in its own evbuffer
+// chain as when it arrives in several TCP reads, 0 adds it as one chain.
+void AddChunks(evbuffer *evb, std::string_view request, size_t chunk) {
+  if (chunk == 0) {
+    chunk = request.size();
+  }
+  for (size_t offset = 0; offset < request.size(); offset += chunk) {
+    auto part = request.substr(offset, chunk);
+    UniquePtr<evbuffer, evbuffer_free> piece(evbuffer_new());
+    evbuffer_add(piece.get(), part.data(), part.size());
+    evbuffer_add_buffer(evb, piece.get());
+  }
+}
+
+void Parse(benchmark::State &state, std::string_view request) {
+  UniquePtr<evbuffer, evbuffer_free> evb(evbuffer_new());
+  AddChunks(evb.get(), request, state.range(0));
+  state.SetLabel(HttpRequestHostParser(evb.get()).Parse());
+  for (auto _ : state) {
+    HttpRequestHostParser parser(evb.get());
+    benchmark::DoNotOptimize(parser.Parse());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ParseOriginForm(benchmark::State &state) {
+  Parse(state, kOriginFormRequest);
+}
+
+void BM_ParseAbsoluteForm(benchmark::State &state) {
+  Parse(state, kAbsoluteFormRequest);
+}
+
+void BM_ParseConnect(benchmark::State &state) {
+  Parse(state, kConnectRequest);
+}
+
+// chunk is the bytes per evbuffer chain, 0 for a single chain.
+BENCHMARK(BM_ParseOriginForm)->ArgName("chunk")->Arg(0)->Arg(16)->Arg(4);
+BENCHMARK(BM_ParseAbsoluteForm)->ArgName("chunk")->Arg(0)->Arg(16)->Arg(4);
+BENCHMARK(BM_ParseConnect)->ArgName("chunk")->Arg(0)->Arg(16)->Arg(4);
+
+}  // namespace
+}  // namespace quic_tunnel
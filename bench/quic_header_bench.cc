@@ -0,0 +1,114 @@
+#include <benchmark/benchmark.h>
+#include <event2/util.h>
+
+#include <cstring>
+#include <vector>
+
+#include "quic/quic_header.h"
+#include "util.h"
+
+namespace quic_tunnel {
+namespace {
+
+ConnectionId RandomId() {
+  ConnectionId id;
+  evutil_secure_rng_get_bytes(id.data(), id.size());
+  return id;
+}
+
+// An Initial packet padded to 1200 bytes, with a Retry token when
+// token_len > 0.
+std::vector<uint8_t> LongHeaderPacket(const ConnectionId &dcid,
+                                      const ConnectionId &scid,
+                                      const uint8_t *token, size_t token_len) {
+  std::vector<uint8_t> packet{0xc3};
+  const uint32_t version = htonl(QUICHE_PROTOCOL_VERSION);
+  const auto *v = reinterpret_cast<const uint8_t *>(&version);
+  packet.insert(packet.end(), v, v + sizeof(version));
+  packet.push_back(dcid.size());
+  packet.insert(packet.end(), dcid.begin(), dcid.end());
+  packet.push_back(scid.size());
+  packet.insert(packet.end(), scid.begin(), scid.end());
+  // 2-byte varint
+  packet.push_back(0x40 | token_len >> 8);
+  packet.push_back(token_len & 0xff);
+  packet.insert(packet.end(), token, token + token_len);
+  const uint16_t length = htons(0x4000 | (1200 - packet.size() - 2));
+  const auto *l = reinterpret_cast<const uint8_t *>(&length);
+  packet.insert(packet.end(), l, l + sizeof(length));
+  packet.resize(1200);
+  return packet;
+}
+
+std::vector<uint8_t> ShortHeaderPacket(const ConnectionId &dcid) {
+  std::vector<uint8_t> packet{0x43};
+  packet.insert(packet.end(), dcid.begin(), dcid.end());
+  packet.resize(1200);
+  return packet;
+}
+
+sockaddr_storage ClientAddr() {
+  sockaddr_storage addr{};
+  ParseAddr("192.0.2.1", 40000, addr);
+  return addr;
+}
+
+// A header as parsed from an Initial packet that got a Retry token.
+QuicHeader MintedHeader(const sockaddr_storage &addr) {
+  QuicHeader header{};
+  header.scid = RandomId();
+  header.dcid = RandomId();
+  header.MintToken(addr);
+  return header;
+}
+
+void BM_ParseShortHeader(benchmark::State &state) {
+  const auto packet = ShortHeaderPacket(RandomId());
+  QuicHeader header;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        QuicHeader::Parse(packet.data(), packet.size(), header));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ParseLongHeader(benchmark::State &state) {
+  const auto minted = MintedHeader(ClientAddr());
+  const auto packet = LongHeaderPacket(
+      RandomId(), RandomId(), minted.token, state.range(0) ? kTokenBytes : 0);
+  QuicHeader header;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        QuicHeader::Parse(packet.data(), packet.size(), header));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_MintToken(benchmark::State &state) {
+  const auto addr = ClientAddr();
+  auto header = MintedHeader(addr);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(header.MintToken(addr));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// ValidateToken overwrites the token, so each iteration validates a copy.
+void BM_ValidateToken(benchmark::State &state) {
+  const auto addr = ClientAddr();
+  const auto minted = MintedHeader(addr);
+  ConnectionId odcid;
+  for (auto _ : state) {
+    auto header = minted;
+    benchmark::DoNotOptimize(header.ValidateToken(addr, odcid));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_ParseShortHeader);
+BENCHMARK(BM_ParseLongHeader)->ArgName("token")->Arg(0)->Arg(1);
+BENCHMARK(BM_MintToken);
+BENCHMARK(BM_ValidateToken);
+
+}  // namespace
+}  // namespace quic_tunnel
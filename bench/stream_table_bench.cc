@@ -0,0 +1,109 @@
+#include <benchmark/benchmark.h>
+
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "stream_id_generator.h"
+#include "stream_table.h"
+
+namespace quic_tunnel {
+namespace {
+
+// Stands in for TcpTunnelCallbacks::StreamCallbacks.
+struct Stream {
+  StreamId stream_id;
+  char state[128];
+};
+
+void BM_StreamIdGeneratorNext(benchmark::State &state) {
+  StreamIdGenerator generator;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(generator.Next());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Streams are looked up round robin, as packets of concurrent streams
+// interleave.
+void BM_StreamTableFind(benchmark::State &state) {
+  StreamIdGenerator generator;
+  StreamTable<Stream> table;
+  std::vector<StreamId> ids;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    ids.push_back(generator.Next());
+    table.Emplace(ids.back(), Stream{ids.back(), {}});
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(table.Find(ids[i]));
+    i = i + 1 == ids.size() ? 0 : i + 1;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_UnorderedMapFind(benchmark::State &state) {
+  StreamIdGenerator generator;
+  std::unordered_map<StreamId, std::unique_ptr<Stream>> map;
+  std::vector<StreamId> ids;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    ids.push_back(generator.Next());
+    map.emplace(ids.back(), std::make_unique<Stream>(Stream{ids.back(), {}}));
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.find(ids[i]));
+    i = i + 1 == ids.size() ? 0 : i + 1;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Closes the oldest stream and opens a new one per iteration, so the number
+// of open streams stays constant while the IDs move on.
+void BM_StreamTableChurn(benchmark::State &state) {
+  StreamIdGenerator generator;
+  StreamTable<Stream> table;
+  std::deque<StreamId> ids;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    ids.push_back(generator.Next());
+    table.Emplace(ids.back(), Stream{ids.back(), {}});
+  }
+
+  for (auto _ : state) {
+    table.Erase(ids.front());
+    ids.pop_front();
+    ids.push_back(generator.Next());
+    table.Emplace(ids.back(), Stream{ids.back(), {}});
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_UnorderedMapChurn(benchmark::State &state) {
+  StreamIdGenerator generator;
+  std::unordered_map<StreamId, std::unique_ptr<Stream>> map;
+  std::deque<StreamId> ids;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    ids.push_back(generator.Next());
+    map.emplace(ids.back(), std::make_unique<Stream>(Stream{ids.back(), {}}));
+  }
+
+  for (auto _ : state) {
+    map.erase(ids.front());
+    ids.pop_front();
+    ids.push_back(generator.Next());
+    map.emplace(ids.back(), std::make_unique<Stream>(Stream{ids.back(), {}}));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_StreamIdGeneratorNext);
+BENCHMARK(BM_StreamTableFind)->Arg(16)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_UnorderedMapFind)->Arg(16)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_StreamTableChurn)->Arg(16)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_UnorderedMapChurn)->Arg(16)->Arg(1000)->Arg(10000);
+
+}  // namespace
+}  // namespace quic_tunnel
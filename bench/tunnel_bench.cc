@@ -0,0 +1,765 @@
+// End-to-end benchmark of the tunnel over loopback. Runs a server and a
+// client quic-tunnel as child processes in front of a built-in TCP sink,
+// drives workloads through them and, for comparison, straight to the sink,
+// then prints the results as JSON on stdout.
+//
+// Usage:
+//   quic-tunnel-bench --cert=cert.crt --key=cert.key [--workload=all]
+//                     [--set=quic.pacing="timer"] [--baseline=false] ...
+// See Options for every flag.
+
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifndef QUIC_TUNNEL_BINARY
+#define QUIC_TUNNEL_BINARY "quic-tunnel"
+#endif
+
+namespace quic_tunnel {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string binary = QUIC_TUNNEL_BINARY;
+  std::string cert;
+  std::string key;
+  // bulk, parallel, rr, churn or all
+  std::string workload = "all";
+  bool baseline = true;
+  uint16_t base_port = 19000;
+  uint64_t bulk_bytes = 1024 * 1024 * 1024;
+  uint32_t streams = 16;
+  uint64_t stream_bytes = 64 * 1024 * 1024;
+  uint32_t requests = 20000;
+  uint32_t request_size = 64;
+  uint32_t response_size = 1024;
+  uint32_t connections = 2000;
+  uint32_t concurrency = 8;
+  // section.key=value, value in TOML syntax
+  std::vector<std::string> client_sets;
+  std::vector<std::string> server_sets;
+};
+
+[[noreturn]] void Fail(const std::string &message) {
+  std::cerr << "quic-tunnel-bench: " << message << std::endl;
+  exit(1);
+}
+
+void Usage() {
+  std::cerr
+      << "Usage: quic-tunnel-bench --cert=PATH --key=PATH [options]\n"
+         "  --binary=PATH         quic-tunnel executable\n"
+         "  --workload=NAME       bulk, parallel, rr, churn or all\n"
+         "  --baseline=BOOL       also run without the tunnel, default true\n"
+         "  --base-port=N         first of 5 loopback ports, default 19000\n"
+         "  --bulk-bytes=N        bytes of the bulk stream\n"
+         "  --streams=N           parallel streams, rr connections\n"
+         "  --stream-bytes=N      bytes of each parallel stream\n"
+         "  --requests=N          rr requests in total\n"
+         "  --request-size=N      rr and churn request bytes\n"
+         "  --response-size=N     rr and churn response bytes\n"
+         "  --connections=N       churn connections in total\n"
+         "  --concurrency=N       churn connections at a time\n"
+         "  --set=S.K=V           set key K of [S] in both confs\n"
+         "  --client-set=S.K=V    set it in the client conf only\n"
+         "  --server-set=S.K=V    set it in the server conf only\n";
+}
+
+uint64_t ParseNumber(std::string_view name, const std::string &value) {
+  char *end;
+  errno = 0;
+  auto n = strtoull(value.c_str(), &end, 10);
+  if (errno != 0 || end == value.c_str() || *end != '\0') {
+    Fail("invalid --" + std::string(name) + ": " + value);
+  }
+  return n;
+}
+
+Options ParseOptions(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    const auto eq = arg.find('=');
+    if (arg.substr(0, 2) != "--" || eq == std::string_view::npos) {
+      Usage();
+      Fail("invalid argument: " + std::string(arg));
+    }
+
+    const auto name = arg.substr(2, eq - 2);
+    const std::string value(arg.substr(eq + 1));
+    if (name == "binary") {
+      options.binary = value;
+    } else if (name == "cert") {
+      options.cert = value;
+    } else if (name == "key") {
+      options.key = value;
+    } else if (name == "workload") {
+      options.workload = value;
+    } else if (name == "baseline") {
+      options.baseline = value == "true" || value == "1";
+    } else if (name == "base-port") {
+      options.base_port = ParseNumber(name, value);
+    } else if (name == "bulk-bytes") {
+      options.bulk_bytes = ParseNumber(name, value);
+    } else if (name == "streams") {
+      options.streams = ParseNumber(name, value);
+    } else if (name == "stream-bytes") {
+      options.stream_bytes = ParseNumber(name, value);
+    } else if (name == "requests") {
+      options.requests = ParseNumber(name, value);
+    } else if (name == "request-size") {
+      options.request_size = ParseNumber(name, value);
+    } else if (name == "response-size") {
+      options.response_size = ParseNumber(name, value);
+    } else if (name == "connections") {
+      options.connections = ParseNumber(name, value);
+    } else if (name == "concurrency") {
+      options.concurrency = ParseNumber(name, value);
+    } else if (name == "set") {
+      options.client_sets.emplace_back(value);
+      options.server_sets.emplace_back(value);
+    } else if (name == "client-set") {
+      options.client_sets.emplace_back(value);
+    } else if (name == "server-set") {
+      options.server_sets.emplace_back(value);
+    } else {
+      Usage();
+      Fail("unknown option: " + std::string(name));
+    }
+  }
+
+  if (options.cert.empty() || options.key.empty()) {
+    Usage();
+    Fail("--cert and --key are required");
+  }
+  if (options.streams == 0 || options.concurrency == 0 ||
+      options.request_size == 0 || options.response_size == 0) {
+    Fail("--streams, --concurrency and the request sizes must not be 0");
+  }
+  return options;
+}
+
+// Loopback TCP helpers, all blocking.
+
+int Listen(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, 1024) != 0) {
+    Fail("failed to listen on port " + std::to_string(port) + ": " +
+         strerror(errno));
+  }
+  return fd;
+}
+
+int Connect(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+bool WriteAll(int fd, const void *buf, size_t len) {
+  const auto *p = static_cast<const char *>(buf);
+  while (len > 0) {
+    auto n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, void *buf, size_t len) {
+  auto *p = static_cast<char *>(buf);
+  while (len > 0) {
+    auto n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Sent first on every connection, tells the sink what to do with it.
+struct SinkHeader {
+  // Bulk mode when response_size is 0: read total_bytes, then ack them
+  // with one byte.
+  uint64_t total_bytes;
+  // Otherwise answer every request_size bytes with response_size bytes
+  // until EOF.
+  uint32_t request_size;
+  uint32_t response_size;
+};
+
+constexpr size_t kChunkSize = 256 * 1024;
+
+class Sink {
+ public:
+  explicit Sink(uint16_t port) : fd_(Listen(port)) {
+    thread_ = std::thread([this] { Accept(); });
+  }
+
+  ~Sink() {
+    shutdown(fd_, SHUT_RDWR);
+    close(fd_);
+    thread_.join();
+    std::lock_guard lock(mutex_);
+    for (auto &thread : connections_) {
+      thread.join();
+    }
+  }
+
+ private:
+  void Accept() {
+    while (true) {
+      int fd = accept(fd_, nullptr, nullptr);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        return;
+      }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      std::lock_guard lock(mutex_);
+      connections_.emplace_back([fd] {
+        Serve(fd);
+        close(fd);
+      });
+    }
+  }
+
+  static void Serve(int fd) {
+    SinkHeader header;
+    if (!ReadAll(fd, &header, sizeof(header))) {
+      return;
+    }
+
+    std::vector<char> buf(std::max<size_t>(
+        kChunkSize, std::max(header.request_size, header.response_size)));
+    if (header.response_size == 0) {
+      uint64_t left = header.total_bytes;
+      while (left > 0) {
+        auto n = read(fd, buf.data(), std::min<uint64_t>(left, buf.size()));
+        if (n <= 0) {
+          return;
+        }
+        left -= n;
+      }
+      WriteAll(fd, "", 1);
+      return;
+    }
+
+    while (ReadAll(fd, buf.data(), header.request_size) &&
+           WriteAll(fd, buf.data(), header.response_size)) {
+    }
+  }
+
+  const int fd_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::vector<std::thread> connections_;
+};
+
+// Counts a hardware, software or tracepoint event of a process. The counter
+// is inherited by the threads and child processes started after it is
+// opened, and a read sums all of them, running or exited. So deltas taken
+// around a workload include the running quic-tunnel processes and all of
+// their worker threads.
+class PerfCounter {
+ public:
+  PerfCounter(pid_t pid, uint32_t type, uint64_t config)
+      : fd_(Open(pid, type, config)) {}
+
+  ~PerfCounter() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  PerfCounter(const PerfCounter &) = delete;
+  PerfCounter &operator=(const PerfCounter &) = delete;
+
+  [[nodiscard]] std::optional<uint64_t> Read() const {
+    uint64_t value;
+    if (fd_ < 0 || read(fd_, &value, sizeof(value)) != sizeof(value)) {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+ private:
+  static int Open(pid_t pid, uint32_t type, uint64_t config) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+  }
+
+  const int fd_;
+};
+
+// The ID of the tracepoint counting system call entries, 0 without tracefs.
+uint64_t SyscallTracepoint() {
+  for (const char *path :
+       {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+        "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"}) {
+    std::ifstream file(path);
+    uint64_t id;
+    if (file >> id) {
+      return id;
+    }
+  }
+  return 0;
+}
+
+// CPU cycles and system calls of this process. The counters are inherited,
+// so they also count the threads and child processes started after them.
+class CostCounters {
+ public:
+  CostCounters() : cycles_(0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES) {
+    if (const auto id = SyscallTracepoint(); id != 0) {
+      syscalls_ = std::make_unique<PerfCounter>(0, PERF_TYPE_TRACEPOINT, id);
+    }
+  }
+
+  [[nodiscard]] std::optional<uint64_t> Cycles() const {
+    return cycles_.Read();
+  }
+  [[nodiscard]] std::optional<uint64_t> Syscalls() const {
+    return syscalls_ ? syscalls_->Read() : std::nullopt;
+  }
+
+ private:
+  PerfCounter cycles_;
+  std::unique_ptr<PerfCounter> syscalls_;
+};
+
+using Conf = std::map<std::string, std::map<std::string, std::string>>;
+
+std::string Quote(const std::string &s) { return "\"" + s + "\""; }
+
+void Apply(Conf &conf, const std::vector<std::string> &sets) {
+  for (const auto &set : sets) {
+    const auto dot = set.find('.');
+    const auto eq = set.find('=');
+    if (dot == std::string::npos || eq == std::string::npos || eq < dot) {
+      Fail("invalid set: " + set);
+    }
+    conf[set.substr(0, dot)][set.substr(dot + 1, eq - dot - 1)] =
+        set.substr(eq + 1);
+  }
+}
+
+void WriteConf(const std::string &path, const Conf &conf) {
+  std::ofstream file(path);
+  for (const auto &[section, keys] : conf) {
+    file << "[" << section << "]\n";
+    for (const auto &[key, value] : keys) {
+      file << key << " = " << value << "\n";
+    }
+    file << "\n";
+  }
+  if (!file) {
+    Fail("failed to write " + path);
+  }
+}
+
+// A quic-tunnel child process, counted by the inherited CostCounters.
+class Tunnel {
+ public:
+  Tunnel(const std::string &binary, const std::string &conf) {
+    pid_ = fork();
+    if (pid_ < 0) {
+      Fail(std::string("fork failed: ") + strerror(errno));
+    }
+
+    if (pid_ == 0) {
+      execl(binary.c_str(), binary.c_str(), "-c", conf.c_str(), nullptr);
+      _exit(127);
+    }
+  }
+
+  ~Tunnel() {
+    kill(pid_, SIGTERM);
+    waitpid(pid_, nullptr, 0);
+  }
+
+  Tunnel(const Tunnel &) = delete;
+  Tunnel &operator=(const Tunnel &) = delete;
+
+  [[nodiscard]] bool IsRunning() const {
+    return waitpid(pid_, nullptr, WNOHANG) == 0;
+  }
+
+ private:
+  pid_t pid_;
+};
+
+struct Result {
+  std::string workload;
+  std::string target;
+  uint64_t bytes{};
+  double seconds{};
+  std::vector<double> latencies_us;
+  std::optional<uint64_t> cycles;
+  std::optional<uint64_t> syscalls;
+};
+
+// A round trip of one request, also run once to warm a target up.
+bool Exchange(int fd, std::vector<char> &buf, uint32_t request_size,
+              uint32_t response_size) {
+  return WriteAll(fd, buf.data(), request_size) &&
+         ReadAll(fd, buf.data(), response_size);
+}
+
+int ConnectTo(uint16_t port, const SinkHeader &header) {
+  int fd = Connect(port);
+  if (fd < 0) {
+    Fail("failed to connect to port " + std::to_string(port) + ": " +
+         strerror(errno));
+  }
+  if (!WriteAll(fd, &header, sizeof(header))) {
+    Fail("failed to send the sink header");
+  }
+  return fd;
+}
+
+double MicrosecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+// Runs f(i) on n threads, each appending latency samples to its own vector.
+template <class F>
+std::vector<double> RunThreads(uint32_t n, F f) {
+  std::vector<std::vector<double>> samples(n);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < n; ++i) {
+    threads.emplace_back([&f, &samples, i] { f(i, samples[i]); });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  std::vector<double> all;
+  for (const auto &s : samples) {
+    all.insert(all.end(), s.begin(), s.end());
+  }
+  return all;
+}
+
+// Sends bytes over one connection and waits for the sink's ack.
+double Stream(uint16_t port, uint64_t bytes) {
+  const auto start = Clock::now();
+  int fd = ConnectTo(port, {bytes, 0, 0});
+  std::vector<char> buf(kChunkSize, 'x');
+  for (uint64_t left = bytes; left > 0;) {
+    const auto n = std::min<uint64_t>(left, buf.size());
+    if (!WriteAll(fd, buf.data(), n)) {
+      Fail("bulk write failed");
+    }
+    left -= n;
+  }
+  char ack;
+  if (!ReadAll(fd, &ack, 1)) {
+    Fail("bulk ack missing");
+  }
+  close(fd);
+  return MicrosecondsSince(start);
+}
+
+void RunWorkload(const Options &options, const std::string &workload,
+                 uint16_t port, Result &result) {
+  result.workload = workload;
+  if (workload == "bulk") {
+    result.bytes = options.bulk_bytes;
+    result.latencies_us.push_back(Stream(port, options.bulk_bytes));
+  } else if (workload == "parallel") {
+    result.bytes = options.stream_bytes * options.streams;
+    result.latencies_us =
+        RunThreads(options.streams, [&](uint32_t, std::vector<double> &s) {
+          s.push_back(Stream(port, options.stream_bytes));
+        });
+  } else if (workload == "rr") {
+    const auto per_connection = options.requests / options.streams;
+    result.bytes = static_cast<uint64_t>(per_connection) * options.streams *
+                   (options.request_size + options.response_size);
+    result.latencies_us =
+        RunThreads(options.streams, [&](uint32_t, std::vector<double> &s) {
+          int fd = ConnectTo(port, {0, options.request_size,
+                                    options.response_size});
+          std::vector<char> buf(
+              std::max(options.request_size, options.response_size), 'x');
+          for (uint32_t i = 0; i < per_connection; ++i) {
+            const auto start = Clock::now();
+            if (!Exchange(fd, buf, options.request_size,
+                          options.response_size)) {
+              Fail("request failed");
+            }
+            s.push_back(MicrosecondsSince(start));
+          }
+          close(fd);
+        });
+  } else if (workload == "churn") {
+    const auto per_thread = options.connections / options.concurrency;
+    result.bytes = static_cast<uint64_t>(per_thread) * options.concurrency *
+                   (options.request_size + options.response_size);
+    result.latencies_us =
+        RunThreads(options.concurrency, [&](uint32_t, std::vector<double> &s) {
+          std::vector<char> buf(
+              std::max(options.request_size, options.response_size), 'x');
+          for (uint32_t i = 0; i < per_thread; ++i) {
+            const auto start = Clock::now();
+            int fd = ConnectTo(port, {0, options.request_size,
+                                      options.response_size});
+            if (!Exchange(fd, buf, options.request_size,
+                          options.response_size)) {
+              Fail("request failed");
+            }
+            close(fd);
+            s.push_back(MicrosecondsSince(start));
+          }
+        });
+  } else {
+    Fail("unknown workload: " + workload);
+  }
+}
+
+Result Run(const Options &options, const std::string &workload,
+           const std::string &target, uint16_t port,
+           const CostCounters &counters) {
+  // Opens the stream, and the QUIC connection of a fresh client.
+  std::vector<char> buf(1, 'x');
+  int fd = ConnectTo(port, {0, 1, 1});
+  if (!Exchange(fd, buf, 1, 1)) {
+    Fail("warm-up request to " + target + " failed");
+  }
+  close(fd);
+
+  Result result;
+  result.target = target;
+  const auto cycles = counters.Cycles();
+  const auto syscalls = counters.Syscalls();
+  const auto start = Clock::now();
+  RunWorkload(options, workload, port, result);
+  result.seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  if (auto now = counters.Cycles(); cycles && now) {
+    result.cycles = *now - *cycles;
+  }
+  if (auto now = counters.Syscalls(); syscalls && now) {
+    result.syscalls = *now - *syscalls;
+  }
+  return result;
+}
+
+double Percentile(const std::vector<double> &sorted, double q) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto rank = static_cast<size_t>(std::ceil(q * sorted.size()));
+  return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+std::string Json(std::optional<double> value) {
+  if (!value) {
+    return "null";
+  }
+  std::ostringstream out;
+  out << *value;
+  return out.str();
+}
+
+void Print(const std::vector<Result> &results) {
+  std::cout << "{\"results\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto r = results[i];
+    std::sort(r.latencies_us.begin(), r.latencies_us.end());
+    std::optional<double> cycles_per_byte;
+    std::optional<double> syscalls_per_mb;
+    if (r.cycles && r.bytes > 0) {
+      cycles_per_byte = static_cast<double>(*r.cycles) / r.bytes;
+    }
+    if (r.syscalls && r.bytes > 0) {
+      syscalls_per_mb = *r.syscalls / (r.bytes / 1e6);
+    }
+    std::cout << (i == 0 ? "\n" : ",\n") << "  {\"workload\": \""
+              << r.workload << "\", \"target\": \"" << r.target
+              << "\", \"bytes\": " << r.bytes
+              << ", \"seconds\": " << r.seconds << ", \"gbit_per_s\": "
+              << r.bytes * 8 / r.seconds / 1e9
+              << ", \"latency_us\": {\"samples\": " << r.latencies_us.size()
+              << ", \"p50\": " << Percentile(r.latencies_us, 0.5)
+              << ", \"p99\": " << Percentile(r.latencies_us, 0.99)
+              << ", \"p999\": " << Percentile(r.latencies_us, 0.999)
+              << "}, \"cpu_cycles_per_byte\": " << Json(cycles_per_byte)
+              << ", \"syscalls_per_mb\": " << Json(syscalls_per_mb) << "}";
+  }
+  std::cout << "\n]}" << std::endl;
+}
+
+// Waits for the client to listen, it binds after connecting to the server.
+void WaitForPort(uint16_t port, const Tunnel &client, const Tunnel &server) {
+  const auto deadline = Clock::now() + std::chrono::seconds(10);
+  while (Clock::now() < deadline) {
+    if (!client.IsRunning() || !server.IsRunning()) {
+      Fail("quic-tunnel exited, see its logs");
+    }
+    if (int fd = Connect(port); fd >= 0) {
+      close(fd);
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  Fail("quic-tunnel client is not listening on port " + std::to_string(port));
+}
+
+}  // namespace
+}  // namespace quic_tunnel
+
+int main(int argc, char **argv) {
+  using namespace quic_tunnel;
+  const auto options = ParseOptions(argc, argv);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<std::string> workloads;
+  if (options.workload == "all") {
+    workloads = {"bulk", "parallel", "rr", "churn"};
+  } else {
+    workloads = {options.workload};
+  }
+
+  char dir_template[] = "/tmp/quic-tunnel-bench.XXXXXX";
+  const char *dir = mkdtemp(dir_template);
+  if (!dir) {
+    Fail(std::string("mkdtemp failed: ") + strerror(errno));
+  }
+  std::cerr << "quic-tunnel-bench: confs and logs in " << dir << std::endl;
+
+  const uint16_t sink_port = options.base_port;
+  const uint16_t quic_port = options.base_port + 1;
+  const uint16_t client_port = options.base_port + 2;
+  // Opened first, so that the sink threads and the quic-tunnel processes
+  // inherit the counters. This process sources and sinks the bytes in both
+  // runs, so its own cost counts too.
+  CostCounters counters;
+  Sink sink(sink_port);
+
+  const std::string local = Quote("127.0.0.1");
+  Conf server_conf = {
+      {"app",
+       {{"server_mode", "true"},
+        {"bind_ip", local},
+        {"bind_port", std::to_string(quic_port)},
+        {"peer_ip", local},
+        {"peer_port", std::to_string(sink_port)}}},
+      {"admin",
+       {{"bind_ip", local},
+        {"bind_port", std::to_string(options.base_port + 3)}}},
+      {"quic",
+       {{"idle_timeout", "60"},
+        {"cert_chain_path", Quote(options.cert)},
+        {"private_key_path", Quote(options.key)}}},
+      {"log",
+       {{"file", Quote(std::string(dir) + "/server.log")},
+        {"level", Quote("warn")},
+        {"flush_level", Quote("warn")}}},
+  };
+  Conf client_conf = {
+      {"app",
+       {{"server_mode", "false"},
+        {"bind_ip", local},
+        {"bind_port", std::to_string(client_port)},
+        {"peer_ip", local},
+        {"peer_port", std::to_string(quic_port)}}},
+      {"admin",
+       {{"bind_ip", local},
+        {"bind_port", std::to_string(options.base_port + 4)}}},
+      {"quic", {{"idle_timeout", "60"}}},
+      {"log",
+       {{"file", Quote(std::string(dir) + "/client.log")},
+        {"level", Quote("warn")},
+        {"flush_level", Quote("warn")}}},
+  };
+  Apply(server_conf, options.server_sets);
+  Apply(client_conf, options.client_sets);
+  const auto server_path = std::string(dir) + "/server.toml";
+  const auto client_path = std::string(dir) + "/client.toml";
+  WriteConf(server_path, server_conf);
+  WriteConf(client_path, client_conf);
+
+  std::vector<Result> results;
+  {
+    Tunnel server(options.binary, server_path);
+    Tunnel client(options.binary, client_path);
+    WaitForPort(client_port, client, server);
+    for (const auto &workload : workloads) {
+      results.emplace_back(
+          Run(options, workload, "tunnel", client_port, counters));
+    }
+  }
+
+  if (options.baseline) {
+    for (const auto &workload : workloads) {
+      results.emplace_back(
+          Run(options, workload, "tcp", sink_port, counters));
+    }
+  }
+
+  Print(results);
+  return 0;
+}
@@ -0,0 +1,29 @@
+#include <benchmark/benchmark.h>
+
+#include "util.h"
+
+namespace quic_tunnel {
+namespace {
+
+void BM_ToString(benchmark::State &state) {
+  sockaddr_storage addr{};
+  ParseAddr("203.0.113.254", 65535, addr);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ToString(addr));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ParseAddr(benchmark::State &state) {
+  sockaddr_storage addr{};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ParseAddr("203.0.113.254", 65535, addr));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_ToString);
+BENCHMARK(BM_ParseAddr);
+
+}  // namespace
+}  // namespace quic_tunnel
@@ -2,7 +2,14 @@
 
 #include <event2/buffer.h>
 
+#include <set>
+#include <vector>
+
 #include "app_config.h"
+#include "metrics.h"
+#include "quic/packet_reader.h"
+#include "quic/packet_writer.h"
+#include "stream_timing.h"
 
 namespace quic_tunnel {
 
@@ -24,6 +31,11 @@ Admin::Admin(EventBase &base)
     throw std::runtime_error("failed to register callback for /stats");
   }
 
+  if (evhttp_set_cb(http_.get(), "/metrics", MetricsCallback, nullptr) != 0) {
+    logger->error("failed to register callback for /metrics");
+    throw std::runtime_error("failed to register callback for /metrics");
+  }
+
   if (evhttp_set_cb(http_.get(), "/quit", QuitCallback, this) != 0) {
     logger->error("failed to register callback for /quit");
     throw std::runtime_error("failed to register callback for /quit");
@@ -44,30 +56,88 @@ int Admin::Bind() {
   return 0;
 }
 
-void Admin::Register(TcpTunnelCallbacks &callbacks) {
-  tcp_tunnel_callbacks_set_.emplace(&callbacks);
+void Admin::Register(TunnelCallbacks &callbacks, EventBase &base) {
+  std::lock_guard lock(mutex_);
+  tunnel_callbacks_map_.emplace(&callbacks, &base);
 }
 
-void Admin::Unregister(TcpTunnelCallbacks &callbacks) {
-  tcp_tunnel_callbacks_set_.erase(&callbacks);
-  if (closing_ && tcp_tunnel_callbacks_set_.empty()) {
+void Admin::Unregister(TunnelCallbacks &callbacks) {
+  std::lock_guard lock(mutex_);
+  tunnel_callbacks_map_.erase(&callbacks);
+  if (closing_ && tunnel_callbacks_map_.empty()) {
     base_.Exit();
   }
 }
 
+void Admin::Stats(EventBase &base, evbuffer *evb) {
+  PacketReader::GetInstance().Stats(evb);
+  PacketWriter::GetInstance().Stats(evb);
+  StreamTiming::Stats(evb);
+  evbuffer_add(evb, "\n", 1);
+
+  // Tunnels only unregister on their own thread, which is this one.
+  std::lock_guard lock(mutex_);
+  for (const auto &[callbacks, callbacks_base] : tunnel_callbacks_map_) {
+    if (callbacks_base == &base) {
+      callbacks->Stats(evb);
+      evbuffer_add(evb, "\n", 1);
+    }
+  }
+}
+
+void Admin::Close(EventBase &base) {
+  std::vector<TunnelCallbacks *> callbacks_list;
+  {
+    std::lock_guard lock(mutex_);
+    for (const auto &[callbacks, callbacks_base] : tunnel_callbacks_map_) {
+      if (callbacks_base == &base) {
+        callbacks_list.emplace_back(callbacks);
+      }
+    }
+  }
+
+  for (auto *callbacks : callbacks_list) {
+    callbacks->Close();
+  }
+}
+
 void Admin::StatsCallback(evhttp_request *req, void *arg) {
   auto *headers = evhttp_request_get_output_headers(req);
   evhttp_add_header(headers, "content-type", "text/plain");
 
-  const auto *admin = static_cast<Admin *>(arg);
+  auto *admin = static_cast<Admin *>(arg);
+  std::set<EventBase *> bases;
+  {
+    std::lock_guard lock(admin->mutex_);
+    for (const auto &[_, base] : admin->tunnel_callbacks_map_) {
+      bases.emplace(base);
+    }
+  }
+
   auto *evb = evhttp_request_get_output_buffer(req);
-  for (const auto *callbacks : admin->tcp_tunnel_callbacks_set_) {
-    callbacks->Stats(evb);
-    evbuffer_add(evb, "\n", 1);
+  for (auto *base : bases) {
+    if (base == &admin->base_) {
+      admin->Stats(*base, evb);
+    } else {
+      UniquePtr<evbuffer, evbuffer_free> worker_evb(evbuffer_new());
+      base->RunSync([admin, base, &worker_evb] {
+        admin->Stats(*base, worker_evb.get());
+      });
+      evbuffer_add_buffer(evb, worker_evb.get());
+    }
   }
   evhttp_send_reply(req, 200, "OK", nullptr);
 }
 
+// Unlike /stats, this reads the metrics of worker threads without stopping
+// their event loops.
+void Admin::MetricsCallback(evhttp_request *req, void *) {
+  auto *headers = evhttp_request_get_output_headers(req);
+  evhttp_add_header(headers, "content-type", "text/plain; version=0.0.4");
+  Metrics::Render(evhttp_request_get_output_buffer(req));
+  evhttp_send_reply(req, 200, "OK", nullptr);
+}
+
 void Admin::QuitCallback(evhttp_request *req, void *arg) {
   auto cmd = evhttp_request_get_command(req);
   if (cmd != EVHTTP_REQ_POST) {
@@ -79,13 +149,26 @@ void Admin::QuitCallback(evhttp_request *req, void *arg) {
   }
 
   auto *admin = static_cast<Admin *>(arg);
-  for (auto *callbacks : admin->tcp_tunnel_callbacks_set_) {
-    callbacks->Close();
+  std::set<EventBase *> bases;
+  {
+    std::lock_guard lock(admin->mutex_);
+    admin->closing_ = true;
+    for (const auto &[_, base] : admin->tunnel_callbacks_map_) {
+      bases.emplace(base);
+    }
+  }
+
+  for (auto *base : bases) {
+    if (base == &admin->base_) {
+      admin->Close(*base);
+    } else {
+      base->RunInLoop([admin, base] { admin->Close(*base); });
+    }
   }
   evhttp_send_reply(req, 200, "OK", nullptr);
 
-  admin->closing_ = true;
-  if (admin->tcp_tunnel_callbacks_set_.empty()) {
+  std::lock_guard lock(admin->mutex_);
+  if (admin->tunnel_callbacks_map_.empty()) {
     admin->timer_.Enable(0);
   }
 }
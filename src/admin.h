@@ -3,27 +3,36 @@
 
 #include <event2/http.h>
 
+#include <map>
+#include <mutex>
+
 #include "event/event_base.h"
-#include "tcp_tunnel_callbacks.h"
+#include "tunnel_callbacks.h"
 #include "util.h"
 
 namespace quic_tunnel {
 
+// Tunnels may be registered from worker threads, each running its own
+// EventBase. Stats and quit requests are run on the owning thread.
 class Admin : NonCopyable {
  public:
   explicit Admin(EventBase &base);
 
   int Bind();
-  void Register(TcpTunnelCallbacks &);
-  void Unregister(TcpTunnelCallbacks &);
+  void Register(TunnelCallbacks &, EventBase &);
+  void Unregister(TunnelCallbacks &);
 
  private:
   static void StatsCallback(evhttp_request *, void *);
+  static void MetricsCallback(evhttp_request *, void *);
   static void QuitCallback(evhttp_request *, void *);
+  void Stats(EventBase &, evbuffer *);
+  void Close(EventBase &);
 
   EventBase &base_;
   UniquePtr<evhttp, evhttp_free> http_;
-  std::set<TcpTunnelCallbacks *> tcp_tunnel_callbacks_set_;
+  std::mutex mutex_;
+  std::map<TunnelCallbacks *, EventBase *> tunnel_callbacks_map_;
   bool closing_{};
   Timer timer_;
 };
@@ -1,5 +1,7 @@
 #include "app_config.h"
 
+#include <algorithm>
+#include <cctype>
 #include <fstream>
 #include <toml.hpp>
 
@@ -8,6 +10,9 @@
 
 namespace {
 
+// Of record_file_size, in MB.
+constexpr uint64_t kMaxRecordFileSize = 1024 * 1024;
+
 bool ResolvePath(const std::string &current_path, std::string &path) {
   if (path.empty()) {
     return false;
@@ -26,9 +31,103 @@ bool ResolvePath(const std::string &current_path, std::string &path) {
   return true;
 }
 
+// Transport defaults selected by [quic] profile. Any key set in [quic]
+// overrides the value of the profile.
+struct TransportProfile {
+  const char *name;
+  const char *cc_algorithm;
+  bool enable_hystart;
+  uint32_t max_ack_delay;  // milliseconds
+  uint32_t ack_delay_exponent;
+  uint32_t initial_max_data;
+  uint32_t initial_max_stream_data;
+};
+
+constexpr uint32_t kMiB = 1024 * 1024;
+
+// lan: short RTT, ACK quickly, windows need not be large.
+// wan: the historical defaults.
+// high-bdp: long fat pipes, large windows, and no HyStart since RTT jitter
+// would end slow start far below the available bandwidth.
+// lossy: random loss ends slow start anyway, so skip HyStart and ACK sooner
+// to detect losses faster, with windows large enough to ride out recovery.
+constexpr TransportProfile kTransportProfiles[] = {
+    {"lan", "cubic", true, 5, 3, 16 * kMiB, 4 * kMiB},
+    {"wan", "cubic", true, 25, 3, 10 * kMiB, 1 * kMiB},
+    {"high-bdp", "cubic", false, 25, 3, 128 * kMiB, 32 * kMiB},
+    {"lossy", "cubic", false, 10, 3, 64 * kMiB, 16 * kMiB},
+};
+
+const TransportProfile *FindTransportProfile(const std::string &name) {
+  for (const auto &profile : kTransportProfiles) {
+    if (name == profile.name) {
+      return &profile;
+    }
+  }
+  return nullptr;
+}
+
 }  // namespace
 
 namespace quic_tunnel {
+namespace {
+
+// See PriorityClass.
+constexpr uint32_t kMaxUrgency = 7;
+
+int LoadPriorityClasses(const toml::value &table, AppConfig &cfg) {
+  cfg.priority_enabled = table.contains("priority");
+  cfg.default_priority = {"default", 3, true, {}, {}, 0};
+  cfg.bulk_priority = {"bulk", 6, true, {}, {}, 0};
+  cfg.priority_classes.clear();
+  if (!cfg.priority_enabled) {
+    return 0;
+  }
+
+  const auto &priority = table.at("priority");
+  auto urgency = toml::find_or<uint32_t>(priority, "default_urgency", 3);
+  auto bulk_urgency = toml::find_or<uint32_t>(priority, "bulk_urgency", 6);
+  if (urgency > kMaxUrgency || bulk_urgency > kMaxUrgency) {
+    logger->error("invalid default_urgency/bulk_urgency: {}/{}", urgency,
+                  bulk_urgency);
+    return -1;
+  }
+  cfg.default_priority.urgency = urgency;
+  cfg.default_priority.bulk_bytes =
+      toml::find_or<uint64_t>(priority, "bulk_bytes", 0);
+  cfg.bulk_priority.urgency = bulk_urgency;
+  if (!priority.contains("classes")) {
+    return 0;
+  }
+
+  for (const auto &value : toml::find<toml::array>(priority, "classes")) {
+    auto &priority_class = cfg.priority_classes.emplace_back();
+    priority_class.name = toml::find<std::string>(value, "name");
+    urgency = toml::find_or<uint32_t>(value, "urgency",
+                                      cfg.default_priority.urgency);
+    if (urgency > kMaxUrgency) {
+      logger->error("invalid urgency of priority class {}: {}",
+                    priority_class.name, urgency);
+      return -1;
+    }
+    priority_class.urgency = urgency;
+    priority_class.incremental =
+        toml::find_or<bool>(value, "incremental", true);
+    priority_class.hosts =
+        toml::find_or(value, "hosts", std::vector<std::string>{});
+    for (auto &host : priority_class.hosts) {
+      std::transform(host.begin(), host.end(), host.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+    }
+    priority_class.ports =
+        toml::find_or(value, "ports", std::vector<uint16_t>{});
+    priority_class.bulk_bytes = toml::find_or<uint64_t>(
+        value, "bulk_bytes", cfg.default_priority.bulk_bytes);
+  }
+  return 0;
+}
+
+}  // namespace
 
 int AppConfig::Load(const std::string &path) {
   try {
@@ -54,30 +153,112 @@ int AppConfig::Load(const std::string &path) {
       return -1;
     }
 
+    cfg.workers = toml::find_or<uint32_t>(app, "workers", 1);
+    if (cfg.workers == 0 || cfg.workers > 256 ||
+        (!cfg.is_server && cfg.workers != 1)) {
+      logger->error("invalid workers: {}", cfg.workers);
+      return -1;
+    }
+
     const auto &admin = toml::find(table, "admin");
     cfg.admin_bind_ip =
         toml::find_or<std::string>(admin, "bind_ip", "127.0.0.1");
     cfg.admin_bind_port = toml::find<uint16_t>(admin, "bind_port");
+    cfg.latency_breakdown =
+        toml::find_or<bool>(admin, "latency_breakdown", false);
+    cfg.latency_per_host =
+        toml::find_or<bool>(admin, "latency_per_host", false);
 
     cfg.tcp_read_watermark = 1024 * 1024;
+    cfg.tcp_direct_write = true;
+    cfg.tcp_write_high_watermark = 1024 * 1024;
+    cfg.tcp_write_low_watermark = 256 * 1024;
+    cfg.tcp_transport = "bufferevent";
     if (table.contains("tcp")) {
       const auto &tcp = table["tcp"];
       cfg.tcp_read_watermark =
           toml::find_or<uint32_t>(tcp, "read_watermark", 1024 * 1024);
+      cfg.tcp_direct_write = toml::find_or<bool>(tcp, "direct_write", true);
+      cfg.tcp_write_high_watermark = toml::find_or<uint32_t>(
+          tcp, "write_high_watermark", 1024 * 1024);
+      cfg.tcp_write_low_watermark = toml::find_or<uint32_t>(
+          tcp, "write_low_watermark", 256 * 1024);
+      if (cfg.tcp_write_low_watermark >= cfg.tcp_write_high_watermark) {
+        logger->error("invalid write_low_watermark/write_high_watermark: {}/{}",
+                      cfg.tcp_write_low_watermark,
+                      cfg.tcp_write_high_watermark);
+        return -1;
+      }
+      cfg.tcp_transport =
+          toml::find_or<std::string>(tcp, "transport", "bufferevent");
+      if (cfg.tcp_transport != "bufferevent" &&
+          cfg.tcp_transport != "socket") {
+        logger->error("invalid tcp transport: {}", cfg.tcp_transport);
+        return -1;
+      }
+    }
+
+    cfg.udp_flow_idle_timeout = 60;
+    cfg.udp_max_flows = 4096;
+    cfg.udp_queue_len = 1024;
+    cfg.udp_reliable_fallback = false;
+    if (table.contains("udp")) {
+      const auto &udp = table["udp"];
+      cfg.udp_flow_idle_timeout =
+          toml::find_or<uint32_t>(udp, "flow_idle_timeout", 60);
+      cfg.udp_max_flows = toml::find_or<uint32_t>(udp, "max_flows", 4096);
+      cfg.udp_queue_len = toml::find_or<uint32_t>(udp, "queue_len", 1024);
+      cfg.udp_reliable_fallback =
+          toml::find_or<bool>(udp, "reliable_fallback", false);
+      if (cfg.udp_flow_idle_timeout == 0 || cfg.udp_max_flows == 0 ||
+          cfg.udp_queue_len == 0) {
+        logger->error("invalid flow_idle_timeout/max_flows/queue_len: {}/{}/{}",
+                      cfg.udp_flow_idle_timeout, cfg.udp_max_flows,
+                      cfg.udp_queue_len);
+        return -1;
+      }
     }
 
     const auto &quic = toml::find(table, "quic");
     cfg.quic_debug_logging =
         toml::find_or<bool>(quic, "enable_debug_logging", false);
     cfg.idle_timeout = toml::find<uint32_t>(quic, "idle_timeout") * 1000;
-    cfg.initial_max_stream_data_bidi_local = toml::find_or<uint32_t>(
-        quic, "initial_max_stream_data_bidi_local", 1024 * 1024);
-    cfg.initial_max_stream_data_bidi_remote = toml::find_or<uint32_t>(
-        quic, "initial_max_stream_data_bidi_remote", 1024 * 1024);
+    cfg.transport_profile = toml::find_or<std::string>(quic, "profile", "wan");
+    const auto *profile = FindTransportProfile(cfg.transport_profile);
+    if (!profile) {
+      logger->error("invalid profile: {}", cfg.transport_profile);
+      return -1;
+    }
+
+    cfg.cc_algorithm =
+        toml::find_or<std::string>(quic, "cc_algorithm", profile->cc_algorithm);
+    if (cfg.cc_algorithm != "cubic" && cfg.cc_algorithm != "reno") {
+      logger->error("unsupported cc_algorithm: {}, expect cubic or reno",
+                    cfg.cc_algorithm);
+      return -1;
+    }
+    cfg.enable_hystart =
+        toml::find_or<bool>(quic, "enable_hystart", profile->enable_hystart);
+    cfg.max_ack_delay =
+        toml::find_or<uint32_t>(quic, "max_ack_delay", profile->max_ack_delay);
+    cfg.ack_delay_exponent = toml::find_or<uint32_t>(
+        quic, "ack_delay_exponent", profile->ack_delay_exponent);
+    if (cfg.max_ack_delay >= 1 << 14 || cfg.ack_delay_exponent > 20) {
+      logger->error("invalid max_ack_delay/ack_delay_exponent: {}/{}",
+                    cfg.max_ack_delay, cfg.ack_delay_exponent);
+      return -1;
+    }
+
+    cfg.initial_max_stream_data_bidi_local =
+        toml::find_or<uint32_t>(quic, "initial_max_stream_data_bidi_local",
+                                profile->initial_max_stream_data);
+    cfg.initial_max_stream_data_bidi_remote =
+        toml::find_or<uint32_t>(quic, "initial_max_stream_data_bidi_remote",
+                                profile->initial_max_stream_data);
     cfg.initial_max_streams_bidi =
         toml::find_or<uint32_t>(quic, "initial_max_streams_bidi", 128);
-    cfg.initial_max_data =
-        toml::find_or<uint32_t>(quic, "initial_max_data", 10 * 1024 * 1024);
+    cfg.initial_max_data = toml::find_or<uint32_t>(quic, "initial_max_data",
+                                                   profile->initial_max_data);
     cfg.max_payload_size =
         toml::find_or<uint32_t>(quic, "max_payload_size", 1350);
     if (cfg.max_payload_size < 1200 ||
@@ -85,6 +266,56 @@ int AppConfig::Load(const std::string &path) {
       logger->error("invalid max_payload_size: {}", cfg.max_payload_size);
       return -1;
     }
+    cfg.pmtud_max_payload_size =
+        toml::find_or<uint32_t>(quic, "pmtud_max_payload_size", 1472);
+    if (cfg.pmtud_max_payload_size > sizeof(quic_buffer)) {
+      logger->error("invalid pmtud_max_payload_size: {}",
+                    cfg.pmtud_max_payload_size);
+      return -1;
+    }
+    cfg.enable_gso = toml::find_or<bool>(quic, "enable_gso", true);
+    cfg.enable_gro = toml::find_or<bool>(quic, "enable_gro", true);
+    cfg.coalesce_egress = toml::find_or<bool>(quic, "coalesce_egress", true);
+    cfg.recv_batch_size = toml::find_or<uint32_t>(quic, "recv_batch_size", 32);
+    if (cfg.recv_batch_size == 0 || cfg.recv_batch_size > 1024) {
+      logger->error("invalid recv_batch_size: {}", cfg.recv_batch_size);
+      return -1;
+    }
+
+    cfg.pacing = toml::find_or<std::string>(quic, "pacing", "off");
+    if (cfg.pacing != "off" && cfg.pacing != "timer" &&
+        cfg.pacing != "txtime") {
+      logger->error("invalid pacing: {}, expect off, timer or txtime",
+                    cfg.pacing);
+      return -1;
+    }
+    cfg.pacing_burst = toml::find_or<uint32_t>(quic, "pacing_burst", 10);
+    if (cfg.pacing_burst == 0 || cfg.pacing_burst > 64) {
+      logger->error("invalid pacing_burst: {}", cfg.pacing_burst);
+      return -1;
+    }
+
+    cfg.connections = toml::find_or<uint32_t>(quic, "connections", 1);
+    cfg.max_connections =
+        toml::find_or<uint32_t>(quic, "max_connections", cfg.connections * 2);
+    if (cfg.connections == 0 || cfg.max_connections < cfg.connections) {
+      logger->error("invalid connections/max_connections: {}/{}",
+                    cfg.connections, cfg.max_connections);
+      return -1;
+    }
+    cfg.reconnect_eagerly =
+        toml::find_or<bool>(quic, "reconnect_eagerly", false);
+
+    cfg.retry_handshake_rate =
+        toml::find_or<uint32_t>(quic, "retry_handshake_rate", 1000);
+    cfg.retry_pending_handshakes =
+        toml::find_or<uint32_t>(quic, "retry_pending_handshakes", 256);
+    cfg.validated_address_ttl =
+        toml::find_or<uint32_t>(quic, "validated_address_ttl", 600);
+
+    if (LoadPriorityClasses(table, cfg) != 0) {
+      return -1;
+    }
 
     if (cfg.is_server) {
       cfg.cert_path = toml::find<std::string>(quic, "cert_chain_path");
@@ -111,6 +342,35 @@ int AppConfig::Load(const std::string &path) {
     cfg.max_log_size =
         toml::find_or<uint32_t>(log, "max_size", 20) * 1024 * 1024;
     cfg.max_logs = toml::find_or<uint32_t>(log, "max_files", 5);
+    cfg.async_logging = toml::find_or<bool>(log, "async", false);
+    cfg.log_queue_size = toml::find_or<uint32_t>(log, "queue_size", 8192);
+    cfg.log_overflow = toml::find_or<std::string>(log, "overflow", "drop");
+    if (cfg.log_queue_size < 2 ||
+        (cfg.log_queue_size & (cfg.log_queue_size - 1)) != 0) {
+      logger->error("invalid queue_size: {}", cfg.log_queue_size);
+      return -1;
+    }
+    if (cfg.log_overflow != "drop" && cfg.log_overflow != "block") {
+      logger->error("invalid overflow: {}", cfg.log_overflow);
+      return -1;
+    }
+
+    cfg.record_file = toml::find_or<std::string>(log, "record_file", "");
+    // MB, checked before scaling so that large values cannot wrap.
+    const auto record_file_size =
+        toml::find_or<uint64_t>(log, "record_file_size", 64);
+    cfg.record_files = toml::find_or<uint32_t>(log, "record_files", 5);
+    if (!cfg.record_file.empty() && !ResolvePath(path, cfg.record_file)) {
+      logger->error("invalid record_file");
+      return -1;
+    }
+    if (record_file_size == 0 || record_file_size > kMaxRecordFileSize ||
+        cfg.record_files == 0) {
+      logger->error("invalid record_file_size/record_files: {}/{}",
+                    record_file_size, cfg.record_files);
+      return -1;
+    }
+    cfg.record_file_size = record_file_size * 1024 * 1024;
   } catch (const std::exception &ex) {
     logger->error("failed to parse {}, {}", path, ex.what());
     return -1;
@@ -4,29 +4,75 @@
 #include <arpa/inet.h>
 
 #include <string>
+#include <vector>
 
 #include "non_copyable.h"
 
 namespace quic_tunnel {
 
+// Streams of a class share a quiche priority, see [priority] in the conf.
+struct PriorityClass {
+  std::string name;
+  uint8_t urgency;  // 0 is the most urgent
+  bool incremental;
+  std::vector<std::string> hosts;
+  std::vector<uint16_t> ports;
+  // A stream is demoted to the bulk class after sending this many bytes, 0
+  // never demotes it.
+  uint64_t bulk_bytes;
+};
+
 struct AppConfig : NonCopyable {
   bool is_server;
   std::string protocol;
   sockaddr_storage bind_addr;
   sockaddr_storage peer_addr;
+  uint32_t workers;
 
   std::string admin_bind_ip;
   uint16_t admin_bind_port;
+  bool latency_breakdown;
+  bool latency_per_host;
 
   uint32_t tcp_read_watermark;
+  bool tcp_direct_write;
+  uint32_t tcp_write_high_watermark;
+  uint32_t tcp_write_low_watermark;
+  std::string tcp_transport;
 
   bool quic_debug_logging;
   uint32_t idle_timeout;
+  std::string transport_profile;
+  std::string cc_algorithm;
+  bool enable_hystart;
+  uint32_t max_ack_delay;
+  uint32_t ack_delay_exponent;
   uint32_t initial_max_stream_data_bidi_local;
   uint32_t initial_max_stream_data_bidi_remote;
   uint32_t initial_max_streams_bidi;
   uint32_t initial_max_data;
   uint32_t max_payload_size;
+  uint32_t pmtud_max_payload_size;
+  bool enable_gso;
+  bool enable_gro;
+  bool coalesce_egress;
+  uint32_t recv_batch_size;
+  std::string pacing;
+  uint32_t pacing_burst;
+  uint32_t connections;
+  uint32_t max_connections;
+  bool reconnect_eagerly;
+  uint32_t retry_handshake_rate;
+  uint32_t retry_pending_handshakes;
+  uint32_t validated_address_ttl;
+  uint32_t udp_flow_idle_timeout;
+  uint32_t udp_max_flows;
+  uint32_t udp_queue_len;
+  bool udp_reliable_fallback;
+  bool priority_enabled;
+  std::vector<PriorityClass> priority_classes;
+  PriorityClass default_priority;
+  PriorityClass bulk_priority;
   std::string cert_path;
   std::string key_path;
 
@@ -36,6 +82,12 @@ struct AppConfig : NonCopyable {
   std::string log_pattern;
   uint32_t max_log_size;
   uint32_t max_logs;
+  bool async_logging;
+  uint32_t log_queue_size;
+  std::string log_overflow;
+  std::string record_file;
+  size_t record_file_size;  // bytes
+  uint32_t record_files;
 
   [[nodiscard]] static int Load(const std::string& path);
 
@@ -0,0 +1,144 @@
+#include "async_log_sink.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace quic_tunnel {
+namespace {
+
+constexpr auto kMaxIdleSleep = std::chrono::milliseconds(1);
+constexpr auto kMinIdleSleep = std::chrono::microseconds(10);
+
+}  // namespace
+
+AsyncLogSink::AsyncLogSink(spdlog::sink_ptr sink, size_t queue_size,
+                           bool block)
+    : sink_(std::move(sink)),
+      block_(block),
+      cells_(queue_size),
+      mask_(queue_size - 1),
+      writer_() {
+  for (size_t i = 0; i < cells_.size(); ++i) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  writer_ = std::thread([this] { Run(); });
+}
+
+AsyncLogSink::~AsyncLogSink() {
+  stopping_.store(true, std::memory_order_release);
+  writer_.join();
+}
+
+// Bounded MPMC queue of Dmitry Vyukov, with a single consumer. A cell is free
+// to write at position pos when its sequence is pos, and ready to read when
+// it is pos + 1.
+void AsyncLogSink::log(const spdlog::details::log_msg &msg) {
+  auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+  Cell *cell;
+  while (true) {
+    cell = &cells_[pos & mask_];
+    const auto sequence = cell->sequence.load(std::memory_order_acquire);
+    const auto diff =
+        static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      if (!block_) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      std::this_thread::yield();
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  auto &message = cell->message;
+  message.time = msg.time;
+  message.source = msg.source;
+  message.level = msg.level;
+  message.thread_id = msg.thread_id;
+  message.text.clear();
+  message.text.append(msg.logger_name.begin(), msg.logger_name.end());
+  message.text.append(msg.payload.begin(), msg.payload.end());
+  message.name_len = msg.logger_name.size();
+  cell->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void AsyncLogSink::flush() {
+  flush_requested_.store(true, std::memory_order_release);
+}
+
+void AsyncLogSink::set_pattern(const std::string &pattern) {
+  sink_->set_pattern(pattern);
+}
+
+void AsyncLogSink::set_formatter(std::unique_ptr<spdlog::formatter> formatter) {
+  sink_->set_formatter(std::move(formatter));
+}
+
+bool AsyncLogSink::Pop() {
+  auto &cell = cells_[dequeue_pos_ & mask_];
+  if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+    return false;
+  }
+
+  const auto &message = cell.message;
+  const auto *text = message.text.data();
+  spdlog::details::log_msg msg(
+      message.time, message.source,
+      spdlog::string_view_t(text, message.name_len), message.level,
+      spdlog::string_view_t(text + message.name_len,
+                            message.text.size() - message.name_len));
+  msg.thread_id = message.thread_id;
+  sink_->log(msg);
+  cell.sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+  ++dequeue_pos_;
+  return true;
+}
+
+// Sleeps, up to kMaxIdleSleep, while the queue stays empty.
+void AsyncLogSink::Run() {
+  std::chrono::microseconds idle_sleep = kMinIdleSleep;
+  uint64_t reported_dropped{};
+  while (true) {
+    bool written{};
+    while (Pop()) {
+      written = true;
+    }
+
+    const auto dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped) {
+      const auto text = fmt::format("log queue full, dropped {} messages",
+                                    dropped - reported_dropped);
+      sink_->log(spdlog::details::log_msg({}, {}, spdlog::level::warn, text));
+      reported_dropped = dropped;
+      written = true;
+    }
+
+    if (flush_requested_.exchange(false, std::memory_order_acquire)) {
+      sink_->flush();
+    }
+
+    if (stopping_.load(std::memory_order_acquire)) {
+      while (Pop()) {
+      }
+      sink_->flush();
+      return;
+    }
+
+    if (written) {
+      idle_sleep = kMinIdleSleep;
+    } else {
+      std::this_thread::sleep_for(idle_sleep);
+      idle_sleep = std::min<std::chrono::microseconds>(idle_sleep * 2,
+                                                        kMaxIdleSleep);
+    }
+  }
+}
+
+}  // namespace quic_tunnel
@@ -0,0 +1,67 @@
+#ifndef QUIC_TUNNEL_ASYNC_LOG_SINK_H_
+#define QUIC_TUNNEL_ASYNC_LOG_SINK_H_
+
+#include <spdlog/sinks/sink.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "non_copyable.h"
+
+namespace quic_tunnel {
+
+// Hands log messages to a dedicated thread, which writes them to the wrapped
+// sink, so event loops never wait for file writes and flushes. Messages pass
+// through a bounded lock-free ring, which any number of threads may log into.
+// When the ring is full a message is dropped, and counted, or the logging
+// thread spins until the writer makes room.
+class AsyncLogSink : NonCopyable, public spdlog::sinks::sink {
+ public:
+  // Only the writer thread uses sink, a single-threaded one will do.
+  AsyncLogSink(spdlog::sink_ptr sink, size_t queue_size, bool block);
+  ~AsyncLogSink() override;
+
+  void log(const spdlog::details::log_msg &msg) override;
+  // Asks the writer to flush once it has written what is queued.
+  void flush() override;
+  // Only before anything is logged.
+  void set_pattern(const std::string &pattern) override;
+  void set_formatter(std::unique_ptr<spdlog::formatter> formatter) override;
+
+ private:
+  // A copy of a log_msg, whose views point into the caller's buffers.
+  struct Message {
+    spdlog::log_clock::time_point time;
+    spdlog::source_loc source;
+    spdlog::level::level_enum level;
+    size_t thread_id;
+    // The logger name followed by the payload.
+    spdlog::memory_buf_t text;
+    size_t name_len;
+  };
+
+  struct Cell {
+    std::atomic<size_t> sequence;
+    Message message;
+  };
+
+  void Run();
+  bool Pop();
+
+  spdlog::sink_ptr sink_;
+  const bool block_;
+  std::vector<Cell> cells_;
+  const size_t mask_;
+  alignas(64) std::atomic<size_t> enqueue_pos_{};
+  alignas(64) size_t dequeue_pos_{};
+  std::atomic<uint64_t> dropped_{};
+  std::atomic<bool> flush_requested_{};
+  std::atomic<bool> stopping_{};
+  std::thread writer_;
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_ASYNC_LOG_SINK_H_
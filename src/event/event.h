@@ -20,6 +20,9 @@ class Event {
     return 0;
   }
 
+  // Safe to call from another thread once evthread_use_pthreads is called.
+  void Activate() { event_active(ev_.get(), EV_TIMEOUT, 0); }
+
   int Disable() {
     if (event_del(ev_.get()) != 0) {
       logger->error("failed to disable event");
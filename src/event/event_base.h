@@ -3,6 +3,9 @@
 
 #include <event2/event.h>
 
+#include <functional>
+#include <future>
+
 #include "event/event.h"
 #include "event/timer.h"
 
@@ -38,6 +41,38 @@ class EventBase {
     return Timer(timer);
   }
 
+  // Runs fn on the thread dispatching this base.
+  int RunInLoop(std::function<void()> fn) {
+    auto *task = new std::function<void()>(std::move(fn));
+    if (event_base_once(
+            base_.get(), -1, EV_TIMEOUT,
+            [](int, short, void *arg) {
+              std::unique_ptr<std::function<void()>> task(
+                  static_cast<std::function<void()> *>(arg));
+              (*task)();
+            },
+            task, nullptr) != 0) {
+      logger->error("failed to schedule task");
+      delete task;
+      return -1;
+    }
+    return 0;
+  }
+
+  // Runs fn on the thread dispatching this base and waits for it to finish.
+  // Must not be called from that thread.
+  int RunSync(std::function<void()> fn) {
+    std::promise<void> done;
+    if (RunInLoop([&fn, &done] {
+          fn();
+          done.set_value();
+        }) != 0) {
+      return -1;
+    }
+    done.get_future().wait();
+    return 0;
+  }
+
   int Dispatch() {
     if (event_base_dispatch(base_.get()) != 0) {
       logger->error("failed to dispatch");
@@ -0,0 +1,115 @@
+#include "http_request_host_parser.h"
+
+#include <strings.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace quic_tunnel {
+
+const char *HttpRequestHostParser::Parse() {
+  const auto max_search_length =
+      std::min(evbuffer_get_length(evb_), sizeof(line_) * 2);
+  evbuffer_ptr search_end;
+  evbuffer_ptr_set(evb_, &search_end, 0, EVBUFFER_PTR_SET);
+  evbuffer_ptr_set(evb_, &search_end, max_search_length, EVBUFFER_PTR_ADD);
+  first_eol_ = evbuffer_search_range(evb_, "\n", 1, nullptr, &search_end);
+  if (first_eol_.pos == -1) {
+    return "";
+  }
+
+  const char *host = ParseFirstLine();
+  if (strlen(host) == 0) {
+    evbuffer_ptr_set(evb_, &first_eol_, 1, EVBUFFER_PTR_ADD);
+    second_eol_ =
+        evbuffer_search_range(evb_, "\n", 1, &first_eol_, &search_end);
+    if (second_eol_.pos != -1) {
+      host = ParseSecondLine();
+    }
+  }
+  return host;
+}
+
+const char *HttpRequestHostParser::ParseFirstLine() {
+  const char http[] = " HTTP/";
+  auto end = evbuffer_search_range(evb_, http, sizeof(http) - 1, nullptr,
+                                   &first_eol_);
+  if (end.pos == -1) {
+    return "";
+  }
+
+  auto begin = evbuffer_search_range(evb_, " ", 1, nullptr, &end);
+  if (begin.pos == -1) {
+    return "";
+  }
+
+  evbuffer_ptr_set(evb_, &begin, 1, EVBUFFER_PTR_ADD);
+  int len = end.pos - begin.pos;
+  if (len == 0 || len >= static_cast<int>(sizeof(line_) - 1)) {
+    return "";
+  }
+
+  len = evbuffer_copyout_from(evb_, &begin, line_, len);
+  if (len == -1) {
+    return "";
+  }
+
+  if (line_[0] == '/') {
+    return "";
+  }
+
+  line_[len] = '\0';
+  char *host = line_;
+  while (*host == ' ') {
+    ++host;
+  }
+
+  char *p = strstr(host, "://");
+  if (p) {
+    host = p + 3;
+  }
+
+  p = host;
+  while (*p && (*p != '/' && *p != ' ')) {
+    ++p;
+  }
+  *p = '\0';
+  return host;
+}
+
+const char *HttpRequestHostParser::ParseSecondLine() {
+  int len = second_eol_.pos - first_eol_.pos;
+  if (len == 0 || len >= static_cast<int>(sizeof(line_) - 1)) {
+    return "";
+  }
+
+  len = evbuffer_copyout_from(evb_, &first_eol_, line_, len);
+  if (len == -1) {
+    return "";
+  }
+
+  line_[len] = '\0';
+  char *host = line_;
+  while (*host && *host != ':') {
+    ++host;
+  }
+
+  if (*host != ':' || host - line_ < 4 ||
+      strncasecmp(host - 4, "host", 4) != 0) {
+    return "";
+  }
+
+  ++host;
+  while (*host == ' ') {
+    ++host;
+  }
+
+  char *p = host;
+  while (*p && (*p != ' ' && *p != '\r')) {
+    ++p;
+  }
+  *p = '\0';
+  return host;
+}
+
+}  // namespace quic_tunnel
@@ -0,0 +1,30 @@
+#ifndef QUIC_TUNNEL_HTTP_REQUEST_HOST_PARSER_H_
+#define QUIC_TUNNEL_HTTP_REQUEST_HOST_PARSER_H_
+
+#include <event2/buffer.h>
+
+namespace quic_tunnel {
+
+// Finds the host of the HTTP request at the start of an evbuffer, from an
+// absolute URI in the request line or else from a Host header in the second
+// line, without draining the evbuffer.
+class HttpRequestHostParser {
+ public:
+  explicit HttpRequestHostParser(evbuffer *evb) : evb_(evb){};
+
+  // Returns "" if no host is found. The result lives in this parser.
+  const char *Parse();
+
+ private:
+  const char *ParseFirstLine();
+  const char *ParseSecondLine();
+
+  evbuffer *evb_;
+  evbuffer_ptr first_eol_;
+  evbuffer_ptr second_eol_;
+  char line_[80];
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_HTTP_REQUEST_HOST_PARSER_H_
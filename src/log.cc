@@ -4,6 +4,8 @@
 #include <spdlog/sinks/rotating_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 
+#include "async_log_sink.h"
+
 namespace {
 
 std::optional<spdlog::level::level_enum> ToLevel(const std::string &s) {
@@ -24,6 +26,14 @@ std::optional<spdlog::level::level_enum> ToLevel(const std::string &s) {
   }
 }
 
+template <class SingleThreadedSink, class MultiThreadedSink, class... Args>
+spdlog::sink_ptr MakeSink(bool mt, Args &&...args) {
+  if (mt) {
+    return std::make_shared<MultiThreadedSink>(std::forward<Args>(args)...);
+  }
+  return std::make_shared<SingleThreadedSink>(std::forward<Args>(args)...);
+}
+
 }  // namespace
 
 namespace quic_tunnel {
@@ -31,29 +41,41 @@ namespace quic_tunnel {
 std::shared_ptr<spdlog::logger> logger = spdlog::stderr_color_st("quic-tunnel");
 
 int InitLogger(const AppConfig &cfg) {
+  // Workers log from their own threads. With async logging only the writer
+  // thread uses the sink.
+  const bool mt = cfg.workers > 1 && !cfg.async_logging;
   spdlog::sink_ptr sink;
   if (cfg.log_file == "/dev/stdout") {
-    sink = std::make_shared<spdlog::sinks::stdout_color_sink_st>();
+    sink = MakeSink<spdlog::sinks::stdout_color_sink_st,
+                    spdlog::sinks::stdout_color_sink_mt>(mt);
   } else if (cfg.log_file == "/dev/stderr") {
-    sink = std::make_shared<spdlog::sinks::stderr_color_sink_st>();
+    sink = MakeSink<spdlog::sinks::stderr_color_sink_st,
+                    spdlog::sinks::stderr_color_sink_mt>(mt);
   } else if (cfg.log_file == "/dev/null") {
-    sink = std::make_shared<spdlog::sinks::null_sink_st>();
+    sink = MakeSink<spdlog::sinks::null_sink_st, spdlog::sinks::null_sink_mt>(
+        mt);
   } else {
     try {
-      sink = std::make_shared<spdlog::sinks::rotating_file_sink_st>(
-          cfg.log_file, cfg.max_log_size, cfg.max_logs);
+      sink = MakeSink<spdlog::sinks::rotating_file_sink_st,
+                      spdlog::sinks::rotating_file_sink_mt>(
+          mt, cfg.log_file, cfg.max_log_size, cfg.max_logs);
     } catch (const spdlog::spdlog_ex &ex) {
       logger->error(ex.what());
       return -1;
     }
   }
 
+  if (!cfg.log_pattern.empty()) {
+    sink->set_pattern(cfg.log_pattern);
+  }
+  if (cfg.async_logging) {
+    sink = std::make_shared<AsyncLogSink>(sink, cfg.log_queue_size,
+                                          cfg.log_overflow == "block");
+  }
+
   logger = std::make_shared<spdlog::logger>("quic-tunnel", sink);
   logger->set_level(ToLevel(cfg.log_level).value_or(spdlog::level::info));
   logger->flush_on(ToLevel(cfg.flush_level).value_or(spdlog::level::warn));
-  if (!cfg.log_pattern.empty()) {
-    logger->set_pattern(cfg.log_pattern);
-  }
   return 0;
 }
 
@@ -2,6 +2,9 @@
 #define QUIC_TUNNEL_LOG_H_
 
 #include <spdlog/spdlog.h>
+#include <time.h>
+
+#include <cstdint>
 
 #include "app_config.h"
 
@@ -11,6 +14,67 @@ extern std::shared_ptr<spdlog::logger> logger;
 
 int InitLogger(const AppConfig &cfg);
 
+// Lets through at most limit messages a second from a call site.
+class LogRateLimiter {
+ public:
+  explicit LogRateLimiter(uint32_t limit) : limit_(limit) {}
+
+  // Returns -1 if the message is to be suppressed, otherwise the number of
+  // messages suppressed since the last one let through.
+  int64_t Acquire() noexcept {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    if (ts.tv_sec != second_) {
+      second_ = ts.tv_sec;
+      count_ = 0;
+    }
+
+    if (count_ >= limit_) {
+      ++suppressed_;
+      return -1;
+    }
+
+    ++count_;
+    const auto suppressed = suppressed_;
+    suppressed_ = 0;
+    return suppressed;
+  }
+
+ private:
+  const uint32_t limit_;
+  int64_t second_{};
+  uint32_t count_{};
+  int64_t suppressed_{};
+};
+
 }  // namespace quic_tunnel
 
+// Logs at most per_second messages a second from this call site and thread,
+// and tells how many were suppressed in between.
+#define LOG_RATE_LIMITED(level, per_second, ...)                              \
+  do {                                                                        \
+    static thread_local ::quic_tunnel::LogRateLimiter log_rate_limiter_(      \
+        per_second);                                                          \
+    if (::quic_tunnel::logger->should_log(level)) {                           \
+      if (const auto suppressed = log_rate_limiter_.Acquire();                \
+          suppressed >= 0) {                                                  \
+        if (suppressed > 0) {                                                 \
+          ::quic_tunnel::logger->log(level, "{} similar messages suppressed", \
+                                     suppressed);                             \
+        }                                                                     \
+        ::quic_tunnel::logger->log(level, __VA_ARGS__);                       \
+      }                                                                       \
+    }                                                                         \
+  } while (false)
+
+// Logs one in every n messages from this call site and thread.
+#define LOG_EVERY_N(level, n, ...)                     \
+  do {                                                 \
+    static thread_local uint64_t log_every_n_count_{}; \
+    if (::quic_tunnel::logger->should_log(level) &&    \
+        log_every_n_count_++ % (n) == 0) {             \
+      ::quic_tunnel::logger->log(level, __VA_ARGS__);  \
+    }                                                  \
+  } while (false)
+
 #endif  // QUIC_TUNNEL_LOG_H_
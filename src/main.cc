@@ -1,9 +1,13 @@
+#include <event2/thread.h>
+
 #include <csignal>
 #include <iostream>
 
 #include "admin.h"
 #include "tcp_tunnel_client.h"
 #include "tcp_tunnel_server.h"
+#include "udp_tunnel_client.h"
+#include "worker.h"
 using namespace quic_tunnel;
 
 namespace {
@@ -55,18 +59,31 @@ int main(int argc, char **argv) {
     return -1;
   }
 
+  if (cfg.workers > 1 && evthread_use_pthreads() != 0) {
+    logger->error("failed to enable libevent thread support");
+    return -1;
+  }
+
   EventBase base;
   Admin admin(base);
   if (admin.Bind() != 0) {
     return -1;
   }
 
-  if (cfg.is_server) {
+  if (cfg.is_server && cfg.workers > 1) {
+    return RunWorkers(quic_config, base, admin);
+  } else if (cfg.is_server) {
     TcpTunnelServer server(quic_config, base, admin);
     if (server.Bind() != 0) {
       return -1;
     }
     return base.Dispatch();
+  } else if (cfg.protocol == "udp") {
+    UdpTunnelClient client(quic_config, base, admin);
+    if (client.Bind(cfg, base)) {
+      return -1;
+    }
+    return base.Dispatch();
   } else {
     TcpTunnelClient client(quic_config, base, admin);
     if (client.Bind(cfg, base)) {
@@ -0,0 +1,199 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace quic_tunnel {
+namespace {
+
+struct MetricInfo {
+  const char *name;
+  const char *help;
+};
+
+constexpr MetricInfo kCounters[] = {
+    {"packets_received_total", "UDP packets received."},
+    {"bytes_received_total", "UDP payload bytes received."},
+    {"packets_sent_total", "UDP packets sent."},
+    {"bytes_sent_total", "UDP payload bytes sent."},
+    {"packets_dropped_total",
+     "UDP packets dropped by the send path or the worker forward queues."},
+    {"send_errors_total", "Failed UDP sends."},
+    {"handshakes_total", "QUIC handshakes started."},
+    {"handshakes_failed_total", "QUIC handshakes that did not complete."},
+    {"retries_total", "QUIC Retry packets sent."},
+    {"version_negotiations_total", "QUIC Version Negotiation packets sent."},
+    {"streams_opened_total", "Tunnel streams opened."},
+    {"streams_closed_total", "Tunnel streams closed."},
+};
+
+constexpr MetricInfo kGauges[] = {
+    {"connections", "Established QUIC connections."},
+    {"streams", "Open tunnel streams."},
+    {"buffered_bytes", "Bytes buffered for TCP connections of streams."},
+};
+
+struct HistogramInfo {
+  const char *name;
+  const char *help;
+  // Values are observed in units of 1 / scale.
+  double scale;
+  std::array<uint64_t, Metrics::kMaxBuckets> bounds;
+  size_t bucket_count;
+};
+
+constexpr uint64_t kKiB = 1024;
+constexpr uint64_t kMiB = 1024 * kKiB;
+
+constexpr HistogramInfo kHistograms[] = {
+    {"stream_duration_seconds",
+     "Lifetime of closed streams.",
+     1000,
+     {10, 100, 500, 1000, 5000, 10000, 30000, 60000, 300000, 1800000,
+      3600000},
+     11},
+    {"stream_bytes",
+     "Bytes received and sent by closed streams.",
+     1,
+     {kKiB, 4 * kKiB, 16 * kKiB, 64 * kKiB, 256 * kKiB, kMiB, 4 * kMiB,
+      16 * kMiB, 64 * kMiB, 256 * kMiB, 1024 * kMiB},
+     11},
+    {"rtt_seconds",
+     "Smoothed RTT of QUIC connections, sampled every second.",
+     1000 * 1000,
+     {1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000,
+      1000000},
+     10},
+    {"cwnd_bytes",
+     "Congestion window of QUIC connections, sampled every second.",
+     1,
+     {16 * kKiB, 32 * kKiB, 64 * kKiB, 128 * kKiB, 256 * kKiB, 512 * kKiB,
+      kMiB, 2 * kMiB, 4 * kMiB, 8 * kMiB, 16 * kMiB, 64 * kMiB},
+     12},
+};
+
+static_assert(std::size(kCounters) == Metrics::kCounterCount);
+static_assert(std::size(kGauges) == Metrics::kGaugeCount);
+static_assert(std::size(kHistograms) == Metrics::kHistogramCount);
+
+constexpr const char kPrefix[] = "quic_tunnel_";
+
+}  // namespace
+
+struct Metrics::Values {
+  std::array<uint64_t, kCounterCount> counters{};
+  std::array<int64_t, kGaugeCount> gauges{};
+  std::array<std::array<uint64_t, kMaxBuckets + 1>, kHistogramCount>
+      buckets{};
+  std::array<uint64_t, kHistogramCount> sums{};
+};
+
+namespace {
+
+// Instances of running threads, and the sum of exited ones.
+struct Registry {
+  std::mutex mutex;
+  std::vector<const Metrics *> instances;
+  Metrics::Values retired;
+};
+
+Registry &GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+}  // namespace
+
+Metrics &Metrics::GetInstance() {
+  static thread_local Metrics metrics;
+  return metrics;
+}
+
+Metrics::Metrics() {
+  auto &registry = GetRegistry();
+  std::lock_guard lock(registry.mutex);
+  registry.instances.emplace_back(this);
+}
+
+Metrics::~Metrics() {
+  auto &registry = GetRegistry();
+  std::lock_guard lock(registry.mutex);
+  AddTo(registry.retired);
+  auto &instances = registry.instances;
+  instances.erase(std::find(instances.begin(), instances.end(), this));
+}
+
+void Metrics::Observe(Histogram histogram, uint64_t value) noexcept {
+  const auto &info = kHistograms[histogram];
+  const auto *bounds = info.bounds.data();
+  const auto bucket =
+      std::lower_bound(bounds, bounds + info.bucket_count, value) - bounds;
+  Add(buckets_[histogram][bucket], uint64_t{1});
+  Add(sums_[histogram], value);
+}
+
+void Metrics::AddTo(Values &values) const {
+  constexpr auto relaxed = std::memory_order_relaxed;
+  for (size_t i = 0; i < kCounterCount; ++i) {
+    values.counters[i] += counters_[i].load(relaxed);
+  }
+  for (size_t i = 0; i < kGaugeCount; ++i) {
+    values.gauges[i] += gauges_[i].load(relaxed);
+  }
+  for (size_t i = 0; i < kHistogramCount; ++i) {
+    for (size_t j = 0; j <= kMaxBuckets; ++j) {
+      values.buckets[i][j] += buckets_[i][j].load(relaxed);
+    }
+    values.sums[i] += sums_[i].load(relaxed);
+  }
+}
+
+void Metrics::Render(evbuffer *evb) {
+  Values values;
+  {
+    auto &registry = GetRegistry();
+    std::lock_guard lock(registry.mutex);
+    values = registry.retired;
+    for (const auto *metrics : registry.instances) {
+      metrics->AddTo(values);
+    }
+  }
+
+  for (size_t i = 0; i < kCounterCount; ++i) {
+    const auto &info = kCounters[i];
+    evbuffer_add_printf(evb, "# HELP %s%s %s\n# TYPE %s%s counter\n%s%s %lu\n",
+                        kPrefix, info.name, info.help, kPrefix, info.name,
+                        kPrefix, info.name, values.counters[i]);
+  }
+
+  for (size_t i = 0; i < kGaugeCount; ++i) {
+    const auto &info = kGauges[i];
+    evbuffer_add_printf(evb, "# HELP %s%s %s\n# TYPE %s%s gauge\n%s%s %ld\n",
+                        kPrefix, info.name, info.help, kPrefix, info.name,
+                        kPrefix, info.name, values.gauges[i]);
+  }
+
+  for (size_t i = 0; i < kHistogramCount; ++i) {
+    const auto &info = kHistograms[i];
+    evbuffer_add_printf(evb, "# HELP %s%s %s\n# TYPE %s%s histogram\n",
+                        kPrefix, info.name, info.help, kPrefix, info.name);
+    uint64_t count{};
+    for (size_t j = 0; j < info.bucket_count; ++j) {
+      count += values.buckets[i][j];
+      evbuffer_add_printf(evb, "%s%s_bucket{le=\"%g\"} %lu\n", kPrefix,
+                          info.name, info.bounds[j] / info.scale, count);
+    }
+    for (size_t j = info.bucket_count; j <= kMaxBuckets; ++j) {
+      count += values.buckets[i][j];
+    }
+    evbuffer_add_printf(evb,
+                        "%s%s_bucket{le=\"+Inf\"} %lu\n%s%s_sum %g\n"
+                        "%s%s_count %lu\n",
+                        kPrefix, info.name, count, kPrefix, info.name,
+                        values.sums[i] / info.scale, kPrefix, info.name,
+                        count);
+  }
+}
+
+}  // namespace quic_tunnel
@@ -0,0 +1,92 @@
+#ifndef QUIC_TUNNEL_METRICS_H_
+#define QUIC_TUNNEL_METRICS_H_
+
+#include <event2/buffer.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "non_copyable.h"
+
+namespace quic_tunnel {
+
+// Process metrics in the Prometheus text format, served at /metrics. Each
+// thread updates its own instance, which only that thread writes, so updates
+// are relaxed loads and stores without any lock or read-modify-write.
+// Rendering sums the instances of all threads, including exited ones.
+class Metrics : NonCopyable {
+ public:
+  enum Counter {
+    kPacketsReceived,
+    kBytesReceived,
+    kPacketsSent,
+    kBytesSent,
+    kPacketsDropped,
+    kSendErrors,
+    kHandshakes,
+    kHandshakesFailed,
+    kRetries,
+    kVersionNegotiations,
+    kStreamsOpened,
+    kStreamsClosed,
+    kCounterCount,
+  };
+
+  enum Gauge {
+    kConnections,
+    kStreams,
+    kBufferedBytes,  // in TCP bufferevents of streams
+    kGaugeCount,
+  };
+
+  enum Histogram {
+    kStreamDuration,  // milliseconds
+    kStreamBytes,
+    kRtt,  // microseconds
+    kCwnd,
+    kHistogramCount,
+  };
+
+  static inline constexpr size_t kMaxBuckets = 16;
+
+  // Plain copy of the values, summed over instances.
+  struct Values;
+
+  static Metrics &GetInstance();
+  static void Render(evbuffer *);
+
+  void Increment(Counter counter, uint64_t n = 1) noexcept {
+    Add(counters_[counter], n);
+  }
+
+  void Add(Gauge gauge, int64_t delta) noexcept {
+    Add(gauges_[gauge], delta);
+  }
+
+  void Observe(Histogram histogram, uint64_t value) noexcept;
+
+ private:
+  template <class T>
+  static void Add(std::atomic<T> &value, T n) noexcept {
+    value.store(value.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+  }
+
+  Metrics();
+  ~Metrics();
+  void AddTo(Values &values) const;
+
+  std::array<std::atomic<uint64_t>, kCounterCount> counters_{};
+  std::array<std::atomic<int64_t>, kGaugeCount> gauges_{};
+  // The last bucket counts values above every bound.
+  std::array<std::array<std::atomic<uint64_t>, kMaxBuckets + 1>,
+             kHistogramCount>
+      buckets_{};
+  std::array<std::atomic<uint64_t>, kHistogramCount> sums_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_METRICS_H_
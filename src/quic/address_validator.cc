@@ -0,0 +1,95 @@
+#include "quic/address_validator.h"
+
+#include <event2/util.h>
+#include <netinet/in.h>
+
+#include <chrono>
+
+#include "app_config.h"
+#include "log.h"
+#include "util.h"
+
+namespace quic_tunnel {
+namespace {
+
+// Direct mapped, a colliding address just evicts the older one.
+constexpr size_t kValidatedAddresses = 4096;
+
+uint32_t Now() {
+  auto duration = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::seconds>(duration).count();
+}
+
+uint32_t Ip(const sockaddr_storage &addr) {
+  return reinterpret_cast<const sockaddr_in *>(&addr)->sin_addr.s_addr;
+}
+
+}  // namespace
+
+AddressValidator::AddressValidator()
+    : handshake_rate_(AppConfig::GetInstance().retry_handshake_rate),
+      pending_handshakes_limit_(
+          AppConfig::GetInstance().retry_pending_handshakes),
+      ttl_(AppConfig::GetInstance().validated_address_ttl),
+      validated_(ttl_ == 0 ? 0 : kValidatedAddresses),
+      hash_key_() {
+  evutil_secure_rng_get_bytes(&hash_key_, sizeof(hash_key_));
+  hash_key_ |= 1;
+}
+
+bool AddressValidator::RequiresRetry(const sockaddr_storage &addr) {
+  const auto now = Now();
+  if (window_second_ != now) {
+    window_second_ = now;
+    window_handshakes_ = 0;
+  }
+
+  // A rate of 0 always sends Retry, validated addresses included.
+  if (handshake_rate_ == 0) {
+    return true;
+  }
+
+  if (IsValidated(addr, now)) {
+    SPDLOG_LOGGER_DEBUG(logger, "skip retry for validated client addr {}",
+                        ToString(addr));
+    return false;
+  }
+
+  return window_handshakes_ >= handshake_rate_ ||
+         pending_handshakes_ >= pending_handshakes_limit_;
+}
+
+void AddressValidator::OnHandshakeStarted() {
+  ++window_handshakes_;
+  ++pending_handshakes_;
+}
+
+void AddressValidator::OnHandshakeFinished(const sockaddr_storage &addr,
+                                           bool established) {
+  assert(pending_handshakes_ > 0);
+  --pending_handshakes_;
+  if (established && ttl_ > 0) {
+    auto ip = Ip(addr);
+    auto &entry = Find(ip);
+    entry.ip = ip;
+    entry.expiry = Now() + ttl_;
+  }
+}
+
+AddressValidator::Entry &AddressValidator::Find(uint32_t ip) {
+  auto hash = (ip * hash_key_) >> 32;
+  return validated_[hash % validated_.size()];
+}
+
+bool AddressValidator::IsValidated(const sockaddr_storage &addr,
+                                   uint32_t now) {
+  if (validated_.empty()) {
+    return false;
+  }
+
+  auto ip = Ip(addr);
+  const auto &entry = Find(ip);
+  return entry.ip == ip && entry.expiry > now;
+}
+
+}  // namespace quic_tunnel
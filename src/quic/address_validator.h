@@ -0,0 +1,48 @@
+#ifndef QUIC_TUNNEL_QUIC_ADDRESS_VALIDATOR_H_
+#define QUIC_TUNNEL_QUIC_ADDRESS_VALIDATOR_H_
+
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "non_copyable.h"
+
+namespace quic_tunnel {
+
+// Decides whether a client must prove its address with a stateless Retry
+// before a connection is accepted. Retry costs a round trip, so it is only
+// required while the worker starts more than retry_handshake_rate handshakes
+// per second or has more than retry_pending_handshakes of them in flight.
+// Addresses that completed a handshake within validated_address_ttl seconds
+// never need it.
+class AddressValidator : NonCopyable {
+ public:
+  AddressValidator();
+
+  [[nodiscard]] bool RequiresRetry(const sockaddr_storage &addr);
+  void OnHandshakeStarted();
+  void OnHandshakeFinished(const sockaddr_storage &addr, bool established);
+
+ private:
+  struct Entry {
+    uint32_t ip;
+    uint32_t expiry;
+  };
+
+  [[nodiscard]] Entry &Find(uint32_t ip);
+  [[nodiscard]] bool IsValidated(const sockaddr_storage &addr, uint32_t now);
+
+  const uint32_t handshake_rate_;
+  const uint32_t pending_handshakes_limit_;
+  const uint32_t ttl_;
+  std::vector<Entry> validated_;
+  uint64_t hash_key_;
+  uint32_t window_second_{};
+  uint32_t window_handshakes_{};
+  uint32_t pending_handshakes_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_QUIC_ADDRESS_VALIDATOR_H_
@@ -3,23 +3,59 @@
 #include <spdlog/fmt/bin_to_hex.h>
 
 #include <algorithm>
+#include <cstring>
 
+#include "app_config.h"
 #include "log.h"
+#include "metrics.h"
+#include "quic/packet_writer.h"
 #include "quic/quic_header.h"
+#include "record_log.h"
 #include "util.h"
 
 namespace quic_tunnel {
+namespace {
+
+// Timers cannot fire much more precisely, so a burst due this soon is sent
+// right away.
+constexpr uint64_t kPacingGranularityNanoseconds = 1000 * 1000;
+
+constexpr uint64_t kSampleIntervalNanoseconds = 1000 * 1000 * 1000;
+
+}  // namespace
 
 Connection::Connection(const QuicConfig &quic_config, EventBase &base, int fd,
                        ConnectionCallbacks &connection_callbacks,
                        const sockaddr_storage &peer_addr)
     : quic_config_(quic_config),
+      start_time_(RecordLog::Now()),
       fd_(fd),
       timer_(base.NewTimer(
           [](int, short, void *arg) {
             static_cast<Connection *>(arg)->OnTimeout();
           },
           this)),
+      flush_event_(base.NewEvent(
+          -1, 0,
+          [](int, short, void *arg) {
+            auto *connection = static_cast<Connection *>(arg);
+            connection->flush_scheduled_ = false;
+            if (connection->conn_) {
+              connection->FlushEgress();
+            }
+          },
+          this)),
+      pacer_(),
+      pacing_timer_(base.NewTimer(
+          [](int, short, void *arg) {
+            auto *connection = static_cast<Connection *>(arg);
+            if (connection->conn_) {
+              connection->FlushEgress();
+            }
+          },
+          this)),
+      path_mtu_(quic_config.max_payload_size(),
+                quic_config.max_udp_payload_size()),
       conn_(nullptr),
       id_(),
       peer_addr_(peer_addr) {
@@ -38,6 +74,7 @@ auto Connection::HexId() const { return spdlog::to_hex(id_); }
 void Connection::Close() {
   if (conn_) {
     if (!IsClosed()) {
+      closed_locally_ = true;
       logger->info("closing QUIC connection {:spn}", HexId());
       if (auto r = quiche_conn_close(conn_, true, 0, nullptr, 0); r != 0) {
         logger->error("failed to close QUIC connection {:spn}, error {}",
@@ -55,18 +92,48 @@ void Connection::Close(StreamId stream_id) {
 }
 
 void Connection::ShutdownRead(StreamId stream_id) {
+  paused_streams_.erase(stream_id);
   quiche_conn_stream_shutdown(conn_, stream_id, QUICHE_SHUTDOWN_READ, 0);
 }
 
+void Connection::SetPriority(StreamId stream_id, uint8_t urgency,
+                             bool incremental) {
+  if (auto r = quiche_conn_stream_priority(conn_, stream_id, urgency,
+                                           incremental);
+      r < 0) {
+    logger->warn("failed to set priority of stream {}, cid {:spn}, error {}",
+                 stream_id, HexId(), r);
+  }
+}
+
+void Connection::PauseRead(StreamId stream_id) {
+  SPDLOG_LOGGER_TRACE(logger, "stream {} read paused, cid {:spn}", stream_id,
+                      HexId());
+  paused_streams_.emplace(stream_id);
+}
+
+void Connection::ResumeRead(StreamId stream_id) {
+  if (paused_streams_.erase(stream_id) == 0 || IsClosed()) {
+    return;
+  }
+
+  SPDLOG_LOGGER_TRACE(logger, "stream {} read resumed, cid {:spn}", stream_id,
+                      HexId());
+  OnStreamRead(stream_id);
+  ScheduleFlush();
+}
+
 void Connection::AddConnectionCallbacks(ConnectionCallbacks &callbacks) {
   callbacks_.emplace_back(&callbacks);
 }
 
-int Connection::Accept(const ConnectionId &dcid, const ConnectionId &odcid,
+int Connection::Accept(const ConnectionId &dcid,
+                       const std::optional<ConnectionId> &odcid,
                        const ConnectionId &scid) {
   assert(!conn_);
-  conn_ = quiche_accept(dcid.data(), dcid.size(), odcid.data(), odcid.size(),
-                        quic_config_.GetConfig());
+  conn_ = quiche_accept(dcid.data(), dcid.size(),
+                        odcid ? odcid->data() : nullptr,
+                        odcid ? odcid->size() : 0, quic_config_.GetConfig());
   id_ = dcid;
   if (!conn_) {
     logger->error(
@@ -78,6 +145,7 @@ int Connection::Accept(const ConnectionId &dcid, const ConnectionId &odcid,
     logger->info(
         "new server QUIC connection {:spn}, scid {:spn}, client addr {}",
         HexId(), spdlog::to_hex(scid), ToString(peer_addr_));
+    Metrics::GetInstance().Increment(Metrics::kHandshakes);
     return 0;
   }
 }
@@ -92,14 +160,76 @@ int Connection::Connect() {
     return -1;
   } else {
     logger->info("new client QUIC connection {:spn}", HexId());
+    Metrics::GetInstance().Increment(Metrics::kHandshakes);
     return FlushEgress();
   }
 }
 
+// Stream writes made by a batch of callbacks are sent together once the
+// current event loop iteration has run them, which fills packets up.
+void Connection::ScheduleFlush() {
+  PacketWriter::GetInstance().OnFlushRequested();
+  if (!AppConfig::GetInstance().coalesce_egress) {
+    FlushEgress();
+  } else if (!flush_scheduled_) {
+    flush_scheduled_ = true;
+    flush_event_->Activate();
+  }
+}
+
 int Connection::FlushEgress() {
+  if (flush_scheduled_) {
+    flush_scheduled_ = false;
+    flush_event_->Disable();
+  }
+
+  auto &writer = PacketWriter::GetInstance();
+  writer.OnFlush();
+  const bool pacing = pacer_.enabled();
+  const bool txtime = pacing && writer.txtime_enabled();
+  const bool pmtud = path_mtu_.enabled() && connected_;
+  quiche_stats stats{};
+  uint64_t now{};
+  if (pacing || pmtud) {
+    quiche_conn_stats(conn_, &stats);
+    now = Pacer::Now();
+  }
+  if (pacing) {
+    pacer_.Update(stats);
+  }
+  if (pmtud) {
+    path_mtu_.Update(stats, now);
+  }
+
+  // With pacing, packets go out in bursts. A burst is either stamped with
+  // its release time for the kernel, or held back with a timer.
+  uint64_t release{};
+  size_t burst_packets{};
+  size_t burst_bytes{};
+  // Failures still fall through to re-arm the timer, which carries loss
+  // recovery and the idle timeout.
+  int r = 0;
   while (true) {
-    ssize_t written =
-        quiche_conn_send(conn_, quic_buffer, quic_config_.max_payload_size());
+    if (pacing && burst_packets == 0) {
+      release = pacer_.NextRelease(now);
+      if (!txtime && release > now + kPacingGranularityNanoseconds) {
+        pacer_.OnHold(release, now);
+        pacing_timer_.Enable((release - now) / 1000);
+        break;
+      }
+    }
+
+    // A path MTU probe goes out alone, so that it is the only packet dropped
+    // if it exceeds the local MTU.
+    const auto size =
+        writer.empty() ? path_mtu_.NextPacketSize() : path_mtu_.size();
+    if (!writer.HasRoom(size) &&
+        writer.Flush(fd_, peer_addr_, txtime ? release : 0) != 0) {
+      r = -1;
+      break;
+    }
+
+    ssize_t written = quiche_conn_send(conn_, writer.tail(), size);
     if (written == QUICHE_ERR_DONE) {
       break;
     }
@@ -107,19 +237,51 @@ int Connection::FlushEgress() {
     if (written < 0) {
       logger->error("failed to create packet: {}, cid {:spn}", written,
                     HexId());
-      return -1;
+      r = -1;
+      break;
+    }
+    writer.Commit(written);
+    sent_bytes_ += written;
+    if (static_cast<size_t>(written) > path_mtu_.size()) {
+      path_mtu_.OnSent(written, stats, now);
+      if (writer.Flush(fd_, peer_addr_, txtime ? release : 0) != 0) {
+        r = -1;
+        break;
+      }
     }
 
-    if (SendTo(fd_, quic_buffer, written, peer_addr_) != 0) {
-      return -1;  // TODO close connection
+    if (!pacing) {
+      continue;
     }
+
+    burst_bytes += written;
+    if (++burst_packets == pacer_.burst()) {
+      pacer_.OnBurst(burst_bytes, burst_packets, release, now);
+      burst_packets = 0;
+      burst_bytes = 0;
+      if (txtime && writer.Flush(fd_, peer_addr_, release) != 0) {
+        r = -1;
+        break;
+      }
+    }
+  }
+
+  if (burst_packets > 0) {
+    pacer_.OnBurst(burst_bytes, burst_packets, release, now);
+  }
+
+  if (writer.Flush(fd_, peer_addr_, txtime ? release : 0) != 0) {
+    r = -1;
   }
 
   auto nanoseconds = quiche_conn_timeout_as_nanos(conn_);
-  return timer_.Enable(nanoseconds / 1000 + 1);
+  if (timer_.Enable(nanoseconds / 1000 + 1) != 0) {
+    r = -1;
+  }
+  return r;
 }
 
-int Connection::OnRead(uint8_t *buf, size_t len, size_t size) {
+int Connection::Feed(uint8_t *buf, size_t len) {
   if (!conn_) {
     logger->warn("recv data on closed connection {:spn}", HexId());
     return -1;
@@ -131,27 +293,46 @@ int Connection::OnRead(uint8_t *buf, size_t len, size_t size) {
     return -1;
   }
 
+  recv_bytes_ += len;
+  drain_pending_ = true;
+  return 0;
+}
+
+int Connection::Drain() {
+  drain_pending_ = false;
+  if (!conn_) {
+    return -1;
+  }
+
   if (IsEstablished()) {
     if (!connected_) {
       connected_ = true;
       logger->info("QUIC connected, cid {:spn}", HexId());
+      Metrics::GetInstance().Add(Metrics::kConnections, 1);
       OnConnected();
     }
+    SampleStats();
 
     auto stream_iter = quiche_conn_readable(conn_);
     for (StreamId stream_id;
          quiche_stream_iter_next(stream_iter, &stream_id);) {
-      OnStreamRead(stream_id, buf, size);
+      if (paused_streams_.empty() ||
+          paused_streams_.find(stream_id) == paused_streams_.end()) {
+        OnStreamRead(stream_id);
+      }
     }
     quiche_stream_iter_free(stream_iter);
+    OnDatagramRead();
   }
 
   auto r = FlushEgress();
-  ReportWritableStreams();
+  OnWritable();
   return r;
 }
 
-void Connection::OnStreamRead(StreamId stream_id, uint8_t *buf, size_t size) {
+void Connection::OnStreamRead(StreamId stream_id) {
+  uint8_t *buf = udp_buffer;
+  const size_t size = sizeof(udp_buffer);
   bool finished{};
   ssize_t count;
   do {
@@ -163,11 +344,12 @@ void Connection::OnStreamRead(StreamId stream_id, uint8_t *buf, size_t size) {
                     HexId());
       break;
     } else {
-      logger->trace("stream {} recv {} bytes, cid {:spn}", stream_id, count,
-                    HexId());
+      SPDLOG_LOGGER_TRACE(logger, "stream {} recv {} bytes, cid {:spn}",
+                          stream_id, count, HexId());
       OnStreamRead(stream_id, buf, count, finished);
     }
-  } while (!(static_cast<size_t>(count) < size || finished));
+  } while (!(static_cast<size_t>(count) < size || finished ||
+             paused_streams_.find(stream_id) != paused_streams_.end()));
 }
 
 void Connection::OnStreamRead(StreamId stream_id, const uint8_t *buf,
@@ -177,6 +359,22 @@ void Connection::OnStreamRead(StreamId stream_id, const uint8_t *buf,
   }
 }
 
+void Connection::OnDatagramRead() {
+  ssize_t count;
+  while ((count = quiche_conn_dgram_recv(conn_, udp_buffer,
+                                         sizeof(udp_buffer))) >= 0) {
+    SPDLOG_LOGGER_TRACE(logger, "datagram recv {} bytes, cid {:spn}", count,
+                        HexId());
+    for (auto *callbacks : callbacks_) {
+      callbacks->OnDatagramRead(udp_buffer, count);
+    }
+  }
+
+  if (count != QUICHE_ERR_DONE) {
+    logger->error("datagram recv error: {}, cid {:spn}", count, HexId());
+  }
+}
+
 void Connection::OnTimeout() {
   quiche_conn_on_timeout(conn_);
   FlushEgress();
@@ -194,12 +392,33 @@ void Connection::OnConnected() {
 void Connection::OnClosed() {
   std::for_each(callbacks_.crbegin(), callbacks_.crend(),
                 [this](auto *callbacks) { callbacks->OnClosed(*this); });
+  auto &metrics = Metrics::GetInstance();
+  if (connected_) {
+    metrics.Add(Metrics::kConnections, -1);
+  } else {
+    metrics.Increment(Metrics::kHandshakesFailed);
+  }
   Stats();
+  WriteRecord();
   quiche_conn_free(conn_);
   conn_ = nullptr;
   timer_.Disable();
 }
 
+void Connection::SampleStats() {
+  const auto now = Pacer::Now();
+  if (now < next_sample_) {
+    return;
+  }
+
+  next_sample_ = now + kSampleIntervalNanoseconds;
+  quiche_stats stats;
+  quiche_conn_stats(conn_, &stats);
+  auto &metrics = Metrics::GetInstance();
+  metrics.Observe(Metrics::kRtt, stats.rtt / 1000);
+  metrics.Observe(Metrics::kCwnd, stats.cwnd);
+}
+
 void Connection::Stats() const {
   quiche_stats stats;
   quiche_conn_stats(conn_, &stats);
@@ -210,15 +429,57 @@ void Connection::Stats() const {
       stats.delivery_rate);
 }
 
+void Connection::WriteRecord() const {
+  auto &records = RecordLog::GetInstance();
+  if (!records.enabled()) {
+    return;
+  }
+
+  quiche_stats stats;
+  quiche_conn_stats(conn_, &stats);
+  Record record{};
+  record.type = Record::kConnection;
+  record.close_reason = !connected_       ? Record::kHandshakeFailed
+                        : closed_locally_ ? Record::kLocalClosed
+                                          : Record::kRemoteClosed;
+  record.cid_len = id_.size();
+  memcpy(record.cid, id_.data(), id_.size());
+  record.start_time = start_time_;
+  record.end_time = RecordLog::Now();
+  record.recv_bytes = recv_bytes_;
+  record.sent_bytes = sent_bytes_;
+  record.rtt = stats.rtt;
+  record.cwnd = stats.cwnd;
+  record.lost = stats.lost;
+  record.delivery_rate = stats.delivery_rate;
+  records.Write(record);
+}
+
 void Connection::Stats(evbuffer *evb) const {
   quiche_stats stats;
   quiche_conn_stats(conn_, &stats);
   auto *end = fmt::format_to(udp_buffer,
                              "connection {:spn} recv={} sent={} lost={} "
-                             "rtt={}ns cwnd={} dilivery_rate={}bytes/s\n",
+                             "rtt={}ns cwnd={} dilivery_rate={}bytes/s "
+                             "paused_streams={}\n",
                              HexId(), stats.recv, stats.sent, stats.lost,
-                             stats.rtt, stats.cwnd, stats.delivery_rate);
-  evbuffer_add(evb, udp_buffer, end - udp_buffer);
+                             stats.rtt, stats.cwnd, stats.delivery_rate,
+                             paused_streams_.size());
+  evbuffer_add(evb, udp_buffer, end - udp_buffer - 1);
+  if (pacer_.enabled()) {
+    evbuffer_add_printf(
+        evb,
+        " pacing_rate=%lubytes/s bursts=%lu packets_per_burst=%.1f "
+        "pacing_delay_avg=%luus pacing_delay_max=%luus",
+        pacer_.rate(), pacer_.bursts(), pacer_.PacketsPerBurst(),
+        pacer_.AverageDelayMicroseconds(), pacer_.max_delay_microseconds());
+  }
+  if (path_mtu_.enabled()) {
+    evbuffer_add_printf(evb, " pmtu=%u pmtu_probes=%lu pmtu_black_holes=%lu",
+                        path_mtu_.size(), path_mtu_.probes(),
+                        path_mtu_.black_holes());
+  }
+  evbuffer_add(evb, "\n", 1);
 }
 
 ssize_t Connection::Send(StreamId stream_id, const uint8_t *buf, size_t buf_len,
@@ -230,33 +491,28 @@ ssize_t Connection::Send(StreamId stream_id, const uint8_t *buf, size_t buf_len,
     return -1;
   }
 
-  logger->trace("stream {} sent {} bytes, cid {:spn}", stream_id, r, HexId());
+  SPDLOG_LOGGER_TRACE(logger, "stream {} sent {} bytes, cid {:spn}", stream_id,
+                      r, HexId());
   if (r > 0 || fin) {
-    if (FlushEgress() != 0) {
-      return -1;
-    }
+    ScheduleFlush();
   }
   return r;
 }
 
-void Connection::ReportWritableStreams() {
-  bool report_writable_streams = std::any_of(
-      callbacks_.cbegin(), callbacks_.cend(),
-      [](const auto *callbacks) { return callbacks->ReportWritableStreams(); });
-  if (!report_writable_streams) {
-    return;
+ssize_t Connection::SendDatagram(const uint8_t *buf, size_t len) {
+  auto r = quiche_conn_dgram_send(conn_, buf, len);
+  if (r >= 0) {
+    SPDLOG_LOGGER_TRACE(logger, "datagram sent {} bytes, cid {:spn}", len,
+                        HexId());
+    ScheduleFlush();
   }
+  return r;
+}
 
-  auto stream_iter = quiche_conn_writable(conn_);
-  for (StreamId stream_id; quiche_stream_iter_next(stream_iter, &stream_id);) {
-    logger->trace("stream {} is writable, cid {:spn}", stream_id, HexId());
-    for (auto *callbacks : callbacks_) {
-      if (callbacks->ReportWritableStreams()) {
-        callbacks->OnStreamWrite(stream_id);
-      }
-    }
+void Connection::OnWritable() {
+  for (auto *callbacks : callbacks_) {
+    callbacks->OnWritable();
   }
-  quiche_stream_iter_free(stream_iter);
 }
 
 }  // namespace quic_tunnel
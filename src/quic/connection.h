@@ -6,9 +6,13 @@
 
 #include <list>
 #include <memory>
+#include <optional>
+#include <unordered_set>
 
 #include "event/event_base.h"
 #include "quic/connection_callbacks.h"
+#include "quic/pacer.h"
+#include "quic/path_mtu.h"
 #include "quic/quic_header.h"
 #include "quic_config.h"
 
@@ -30,41 +34,91 @@ class Connection : NonCopyable {
   }
 
   [[nodiscard]] const ConnectionId &id() const noexcept { return id_; }
+  [[nodiscard]] const sockaddr_storage &peer_addr() const noexcept {
+    return peer_addr_;
+  }
 
   [[nodiscard]] auto PeerStreamsLeft() const noexcept {
     return quiche_conn_peer_streams_left_bidi(conn_);
   }
 
+  [[nodiscard]] ssize_t StreamCapacity(StreamId stream_id) const {
+    return quiche_conn_stream_capacity(conn_, stream_id);
+  }
+
+  [[nodiscard]] quiche_stats stats() const {
+    quiche_stats stats;
+    quiche_conn_stats(conn_, &stats);
+    return stats;
+  }
+
   void AddConnectionCallbacks(ConnectionCallbacks &callbacks);
-  int Accept(const ConnectionId &dcid, const ConnectionId &odcid,
+  int Accept(const ConnectionId &dcid,
+             const std::optional<ConnectionId> &odcid,
              const ConnectionId &scid);
   int Connect();
   ssize_t Send(StreamId stream_id, const uint8_t *buf, size_t buf_len,
                bool fin);
+  // Returns QUICHE_ERR_DONE if the datagram send queue is full, and
+  // QUICHE_ERR_BUFFER_TOO_SHORT if len exceeds MaxDatagramSize().
+  ssize_t SendDatagram(const uint8_t *buf, size_t len);
+  // Returns a negative value if the peer does not accept DATAGRAM frames.
+  [[nodiscard]] ssize_t MaxDatagramSize() const {
+    return quiche_conn_dgram_max_writable_len(conn_);
+  }
   void Close();
   void Close(StreamId);
   void ShutdownRead(StreamId);
-  int OnRead(uint8_t *buf, size_t len, size_t size);
+  // Urgency 0 is sent first. Streams of the same urgency share the bandwidth
+  // if incremental, and are sent one after another otherwise.
+  void SetPriority(StreamId, uint8_t urgency, bool incremental);
+  // A paused stream is not drained from quiche, so flow control pushes back
+  // on the peer until the stream is resumed.
+  void PauseRead(StreamId);
+  void ResumeRead(StreamId);
+  // Received packets are fed to quiche one at a time. The connection is then
+  // drained once per receive batch: readable streams are read, egress is
+  // flushed and blocked streams are checked.
+  int Feed(uint8_t *buf, size_t len);
+  int Drain();
+  [[nodiscard]] bool IsDrainPending() const noexcept { return drain_pending_; }
   void Stats(evbuffer *) const;
 
  private:
-  void OnStreamRead(StreamId stream_id, uint8_t *buf, size_t size);
+  void OnStreamRead(StreamId stream_id);
   void OnStreamRead(StreamId, const uint8_t *, size_t, bool);
+  void OnDatagramRead();
   int FlushEgress();
+  void ScheduleFlush();
   void OnTimeout();
   void OnConnected();
   void OnClosed();
+  // Feeds the RTT and cwnd histograms of the metrics, once per interval.
+  void SampleStats();
   void Stats() const;
-  void ReportWritableStreams();
+  void WriteRecord() const;
+  void OnWritable();
   [[nodiscard]] auto HexId() const;
 
   const QuicConfig &quic_config_;
   bool connected_{};
+  bool closed_locally_{};
+  const uint64_t start_time_;
+  uint64_t recv_bytes_{};
+  uint64_t sent_bytes_{};
 
   const int fd_;
   Timer timer_;
+  std::unique_ptr<Event> flush_event_;
+  bool flush_scheduled_{};
+  bool drain_pending_{};
+  Pacer pacer_;
+  Timer pacing_timer_;
+  PathMtu path_mtu_;
+  uint64_t next_sample_{};
   quiche_conn *conn_;
   std::list<ConnectionCallbacks *> callbacks_;
+  std::unordered_set<StreamId> paused_streams_;
   ConnectionId id_;
   const sockaddr_storage peer_addr_;
 };
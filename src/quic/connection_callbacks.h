@@ -12,8 +12,11 @@ class ConnectionCallbacks {
   virtual void OnConnected(Connection &) = 0;
   virtual void OnClosed(Connection &) = 0;
   virtual void OnStreamRead(StreamId, const uint8_t *, size_t, bool) = 0;
-  virtual void OnStreamWrite(StreamId) = 0;
-  [[nodiscard]] virtual bool ReportWritableStreams() const = 0;
+  // Called after received packets were processed, which may have given
+  // blocked streams send capacity again.
+  virtual void OnWritable() = 0;
+  // A QUIC DATAGRAM frame, only received if the protocol is udp.
+  virtual void OnDatagramRead(const uint8_t *, size_t) = 0;
 };
 
 }  // namespace quic_tunnel
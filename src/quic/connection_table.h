@@ -0,0 +1,156 @@
+#ifndef QUIC_TUNNEL_QUIC_CONNECTION_TABLE_H_
+#define QUIC_TUNNEL_QUIC_CONNECTION_TABLE_H_
+
+#include <event2/util.h>
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "non_copyable.h"
+#include "quic/quic_header.h"
+
+namespace quic_tunnel {
+
+// Open addressing hash table keyed by ConnectionId. Entries are stored inline
+// and probed linearly. Erase shifts the following entries of the probe
+// sequence back instead of leaving tombstones, so lookups never slow down as
+// connections come and go.
+template <class Value>
+class ConnectionTable : NonCopyable {
+ public:
+  ConnectionTable() : slots_(kMinCapacity), mask_(kMinCapacity - 1) {}
+
+  [[nodiscard]] size_t size() const noexcept { return size_; }
+  [[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+
+  Value *Find(const ConnectionId &id) {
+    for (auto i = Home(id);; i = (i + 1) & mask_) {
+      auto &slot = slots_[i];
+      if (!slot.used) {
+        return nullptr;
+      }
+      if (slot.id == id) {
+        return &slot.value;
+      }
+    }
+  }
+
+  // Returns the value for id and whether it was inserted. The pointer is
+  // invalidated by the next Emplace or Erase.
+  std::pair<Value *, bool> Emplace(const ConnectionId &id, Value value) {
+    if ((size_ + 1) * 4 > slots_.size() * 3) {
+      Rehash(slots_.size() * 2);
+    }
+
+    auto i = Home(id);
+    for (; slots_[i].used; i = (i + 1) & mask_) {
+      if (slots_[i].id == id) {
+        return {&slots_[i].value, false};
+      }
+    }
+
+    auto &slot = slots_[i];
+    slot.used = true;
+    slot.id = id;
+    slot.value = std::move(value);
+    ++size_;
+    return {&slot.value, true};
+  }
+
+  bool Erase(const ConnectionId &id) {
+    auto i = Home(id);
+    for (; slots_[i].used; i = (i + 1) & mask_) {
+      if (slots_[i].id == id) {
+        break;
+      }
+    }
+    if (!slots_[i].used) {
+      return false;
+    }
+
+    slots_[i].used = false;
+    slots_[i].value = Value();
+    --size_;
+
+    // Move back every following entry whose home slot is not in (i, j].
+    for (auto j = (i + 1) & mask_; slots_[j].used; j = (j + 1) & mask_) {
+      auto home = Home(slots_[j].id);
+      if (((j - home) & mask_) >= ((j - i) & mask_)) {
+        slots_[i] = std::move(slots_[j]);
+        slots_[j].used = false;
+        slots_[j].value = Value();
+        i = j;
+      }
+    }
+    return true;
+  }
+
+  template <class F>
+  void ForEach(F &&f) {
+    for (auto &slot : slots_) {
+      if (slot.used) {
+        f(slot.id, slot.value);
+      }
+    }
+  }
+
+  void Clear() {
+    slots_ = std::vector<Slot>(kMinCapacity);
+    mask_ = kMinCapacity - 1;
+    size_ = 0;
+  }
+
+ private:
+  struct Slot {
+    ConnectionId id{};
+    bool used{};
+    Value value{};
+  };
+
+  // Connection IDs are mostly random, but the ones chosen by clients are not
+  // ours, so the hash is keyed with a per-process secret.
+  [[nodiscard]] size_t Home(const ConnectionId &id) const noexcept {
+    static const auto keys = [] {
+      std::pair<uint64_t, uint64_t> keys;
+      evutil_secure_rng_get_bytes(&keys, sizeof(keys));
+      return keys;
+    }();
+
+    uint64_t lo;
+    uint64_t hi;
+    memcpy(&lo, id.data(), sizeof(lo));
+    memcpy(&hi, id.data() + sizeof(lo), sizeof(hi));
+    __extension__ using Uint128 = unsigned __int128;
+    Uint128 product = static_cast<Uint128>(lo ^ keys.first) *
+                      (hi ^ keys.second ^ 0x9e3779b97f4a7c15);
+    return (static_cast<uint64_t>(product) ^
+            static_cast<uint64_t>(product >> 64)) &
+           mask_;
+  }
+
+  void Rehash(size_t capacity) {
+    auto slots = std::vector<Slot>(capacity);
+    slots.swap(slots_);
+    mask_ = capacity - 1;
+    for (auto &slot : slots) {
+      if (slot.used) {
+        auto i = Home(slot.id);
+        while (slots_[i].used) {
+          i = (i + 1) & mask_;
+        }
+        slots_[i] = std::move(slot);
+      }
+    }
+  }
+
+  static inline constexpr size_t kMinCapacity = 64;
+
+  std::vector<Slot> slots_;
+  size_t mask_;
+  size_t size_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_QUIC_CONNECTION_TABLE_H_
@@ -0,0 +1,68 @@
+#include "quic/pacer.h"
+
+#include <algorithm>
+#include <ctime>
+
+#include "app_config.h"
+
+namespace quic_tunnel {
+namespace {
+
+// Pace slightly faster than cwnd per RTT so the window can still grow.
+constexpr uint64_t kPacingGainPercent = 125;
+constexpr uint64_t kNanosecondsPerSecond = 1000 * 1000 * 1000;
+
+}  // namespace
+
+Pacer::Pacer()
+    : burst_(AppConfig::GetInstance().pacing == "off"
+                 ? 0
+                 : AppConfig::GetInstance().pacing_burst) {}
+
+uint64_t Pacer::Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * kNanosecondsPerSecond + ts.tv_nsec;
+}
+
+double Pacer::PacketsPerBurst() const noexcept {
+  return bursts_ == 0 ? 0.0 : static_cast<double>(packets_) / bursts_;
+}
+
+uint64_t Pacer::AverageDelayMicroseconds() const noexcept {
+  return bursts_ == 0 ? 0 : total_delay_ / bursts_ / 1000;
+}
+
+void Pacer::Update(const quiche_stats &stats) noexcept {
+  if (stats.rtt == 0) {
+    rate_ = 0;
+    return;
+  }
+  rate_ = stats.cwnd * kNanosecondsPerSecond / stats.rtt *
+          kPacingGainPercent / 100;
+}
+
+uint64_t Pacer::NextRelease(uint64_t now) noexcept {
+  next_release_ = std::max(next_release_, now);
+  return next_release_;
+}
+
+void Pacer::OnBurst(size_t bytes, size_t packets, uint64_t release,
+                    uint64_t now) noexcept {
+  ++bursts_;
+  packets_ += packets;
+  if (release > now) {
+    OnHold(release, now);
+  }
+  if (rate_ > 0) {
+    next_release_ = release + bytes * kNanosecondsPerSecond / rate_;
+  }
+}
+
+void Pacer::OnHold(uint64_t release, uint64_t now) noexcept {
+  const auto delay = release - now;
+  total_delay_ += delay;
+  max_delay_ = std::max(max_delay_, delay);
+}
+
+}  // namespace quic_tunnel
@@ -0,0 +1,56 @@
+#ifndef QUIC_TUNNEL_QUIC_PACER_H_
+#define QUIC_TUNNEL_QUIC_PACER_H_
+
+#include <quiche.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace quic_tunnel {
+
+// Spreads the packets of a connection over its round trip time. quiche does
+// not report release times, so the pacing rate is derived from the
+// congestion window and the smoothed RTT. Packets leave in bursts of up to
+// pacing_burst packets, each released once the previous burst has drained at
+// the pacing rate. Times are CLOCK_MONOTONIC nanoseconds, the clock SO_TXTIME
+// expects.
+class Pacer {
+ public:
+  Pacer();
+
+  [[nodiscard]] static uint64_t Now();
+
+  [[nodiscard]] bool enabled() const noexcept { return burst_ > 0; }
+  [[nodiscard]] size_t burst() const noexcept { return burst_; }
+  [[nodiscard]] uint64_t rate() const noexcept { return rate_; }
+  [[nodiscard]] size_t bursts() const noexcept { return bursts_; }
+  [[nodiscard]] double PacketsPerBurst() const noexcept;
+  // Average time a burst was held back by pacing.
+  [[nodiscard]] uint64_t AverageDelayMicroseconds() const noexcept;
+  [[nodiscard]] uint64_t max_delay_microseconds() const noexcept {
+    return max_delay_ / 1000;
+  }
+
+  void Update(const quiche_stats &stats) noexcept;
+  // Returns when the next burst may leave. Unused time is not saved up, so
+  // an idle connection does not get to send a larger burst later.
+  [[nodiscard]] uint64_t NextRelease(uint64_t now) noexcept;
+  void OnBurst(size_t bytes, size_t packets, uint64_t release,
+               uint64_t now) noexcept;
+  // Egress is held in user space until the next release.
+  void OnHold(uint64_t release, uint64_t now) noexcept;
+
+ private:
+  const size_t burst_;
+  uint64_t rate_{};  // bytes per second, 0 until an RTT is measured
+  uint64_t next_release_{};
+
+  size_t bursts_{};
+  size_t packets_{};
+  uint64_t total_delay_{};
+  uint64_t max_delay_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_QUIC_PACER_H_
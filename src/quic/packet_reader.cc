@@ -0,0 +1,130 @@
+#include "quic/packet_reader.h"
+
+#include <netinet/udp.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "app_config.h"
+#include "log.h"
+#include "metrics.h"
+
+namespace quic_tunnel {
+namespace {
+
+constexpr size_t kControlBytes = CMSG_SPACE(sizeof(int));
+constexpr size_t kMaxDatagramBytes = 65535;
+
+// Path MTU probes may be larger than max_payload_size.
+size_t MaxUdpPayloadSize() {
+  const auto &cfg = AppConfig::GetInstance();
+  return std::max(cfg.max_payload_size, cfg.pmtud_max_payload_size);
+}
+
+}  // namespace
+
+PacketReader &PacketReader::GetInstance() {
+  static thread_local PacketReader reader;
+  return reader;
+}
+
+PacketReader::PacketReader()
+    : gro_enabled_(AppConfig::GetInstance().enable_gro),
+      batch_size_(AppConfig::GetInstance().recv_batch_size),
+      slot_size_(gro_enabled_ ? kMaxDatagramBytes : MaxUdpPayloadSize()),
+      buffer_(new uint8_t[batch_size_ * slot_size_]),
+      iovs_(batch_size_),
+      msgs_(batch_size_),
+      addrs_(batch_size_),
+      control_(new char[batch_size_ * kControlBytes]),
+      packets_() {
+  packets_.reserve(batch_size_);
+}
+
+void PacketReader::Setup(int fd) const {
+  if (!gro_enabled_) {
+    return;
+  }
+
+  int enabled = 1;
+  if (setsockopt(fd, SOL_UDP, UDP_GRO, &enabled, sizeof(enabled)) != 0) {
+    logger->warn("failed to enable UDP GRO: {}, fd: {}", strerror(errno), fd);
+  }
+}
+
+int PacketReader::Read(int fd) {
+  packets_.clear();
+  messages_ = 0;
+  for (size_t i = 0; i < batch_size_; ++i) {
+    iovs_[i] = {buffer_.get() + i * slot_size_, slot_size_};
+    auto &hdr = msgs_[i].msg_hdr;
+    hdr.msg_name = &addrs_[i];
+    hdr.msg_namelen = sizeof(addrs_[i]);
+    hdr.msg_iov = &iovs_[i];
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control_.get() + i * kControlBytes;
+    hdr.msg_controllen = kControlBytes;
+    hdr.msg_flags = 0;
+  }
+
+  ++syscalls_;
+  int count = recvmmsg(fd, msgs_.data(), batch_size_, 0, nullptr);
+  if (count < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+    logger->error("recvmmsg error: {}, fd: {}", strerror(errno), fd);
+    return -1;
+  }
+
+  messages_ = count;
+  const auto bytes = bytes_;
+  for (int i = 0; i < count; ++i) {
+    auto &hdr = msgs_[i].msg_hdr;
+    size_t len = msgs_[i].msg_len;
+    if (hdr.msg_flags & MSG_TRUNC) {
+      LOG_RATE_LIMITED(spdlog::level::warn, 10,
+                       "UDP datagram truncated, fd: {}", fd);
+      continue;
+    }
+
+    size_t segment = len;
+    for (auto *cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+         cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+      if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+        int gso_size;
+        memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+        segment = gso_size;
+        ++gro_datagrams_;
+        break;
+      }
+    }
+
+    SPDLOG_LOGGER_TRACE(logger, "UDP recv {} bytes, segment {} bytes", len,
+                        segment);
+    bytes_ += len;
+    auto *data = static_cast<uint8_t *>(iovs_[i].iov_base);
+    for (size_t offset = 0; offset < len; offset += segment) {
+      packets_.push_back(
+          {data + offset, std::min(segment, len - offset), &addrs_[i]});
+    }
+  }
+  packets_received_ += packets_.size();
+  auto &metrics = Metrics::GetInstance();
+  metrics.Increment(Metrics::kPacketsReceived, packets_.size());
+  metrics.Increment(Metrics::kBytesReceived, bytes_ - bytes);
+  return count;
+}
+
+void PacketReader::Stats(evbuffer *evb) const {
+  evbuffer_add_printf(
+      evb,
+      "ingress packets=%lu bytes=%lu syscalls=%lu gro_datagrams=%lu "
+      "packets_per_syscall=%.2f\n",
+      packets_received_, bytes_, syscalls_, gro_datagrams_,
+      syscalls_ == 0 ? 0.0
+                     : static_cast<double>(packets_received_) / syscalls_);
+}
+
+}  // namespace quic_tunnel
@@ -0,0 +1,68 @@
+#ifndef QUIC_TUNNEL_QUIC_PACKET_READER_H_
+#define QUIC_TUNNEL_QUIC_PACKET_READER_H_
+
+#include <event2/buffer.h>
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "non_copyable.h"
+
+namespace quic_tunnel {
+
+// Receives up to batch_size datagrams per recvmmsg call into a ring of
+// preallocated buffers. UDP_GRO coalesced datagrams are split back into
+// packets using the segment size from the control message. There is one
+// reader per thread.
+class PacketReader : NonCopyable {
+ public:
+  struct Packet {
+    uint8_t *data;
+    size_t len;
+    const sockaddr_storage *peer_addr;
+  };
+
+  static PacketReader &GetInstance();
+
+  // Enables UDP_GRO on the socket if configured and supported.
+  void Setup(int fd) const;
+
+  // Returns the number of datagrams received, 0 if none is available.
+  int Read(int fd);
+
+  [[nodiscard]] const std::vector<Packet> &packets() const noexcept {
+    return packets_;
+  }
+
+  // Whether the last Read filled the whole batch, so more may be queued.
+  [[nodiscard]] bool IsFull() const noexcept {
+    return messages_ == batch_size_;
+  }
+
+  void Stats(evbuffer *) const;
+
+ private:
+  PacketReader();
+
+  const bool gro_enabled_;
+  const size_t batch_size_;
+  const size_t slot_size_;
+  std::unique_ptr<uint8_t[]> buffer_;
+  std::vector<iovec> iovs_;
+  std::vector<mmsghdr> msgs_;
+  std::vector<sockaddr_storage> addrs_;
+  std::unique_ptr<char[]> control_;
+  std::vector<Packet> packets_;
+  size_t messages_{};
+
+  size_t packets_received_{};
+  size_t bytes_{};
+  size_t syscalls_{};
+  size_t gro_datagrams_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_QUIC_PACKET_READER_H_
@@ -0,0 +1,275 @@
+#include "quic/packet_writer.h"
+
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "app_config.h"
+#include "log.h"
+#include "metrics.h"
+
+namespace quic_tunnel {
+namespace {
+
+bool IsGsoSupported() {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd == -1) {
+    return false;
+  }
+
+  int segment;
+  socklen_t len = sizeof(segment);
+  bool supported = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, &len) == 0;
+  close(fd);
+  return supported;
+}
+
+bool IsTransient(int error) {
+  return error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS;
+}
+
+constexpr size_t kControlBytes =
+    CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t));
+
+// Attaches the GSO segment size and the release time, when not 0, to msg.
+// control must hold kControlBytes zeroed bytes.
+void SetControl(msghdr &msg, char *control, uint16_t segment,
+                uint64_t txtime) {
+  msg.msg_control = control;
+  msg.msg_controllen = kControlBytes;
+  size_t len{};
+  auto *cmsg = CMSG_FIRSTHDR(&msg);
+  if (segment > 0) {
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(segment));
+    memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+    len += CMSG_SPACE(sizeof(segment));
+    cmsg = CMSG_NXTHDR(&msg, cmsg);
+  }
+
+  if (txtime > 0) {
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(txtime));
+    memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+    len += CMSG_SPACE(sizeof(txtime));
+  }
+
+  msg.msg_controllen = len;
+  if (len == 0) {
+    msg.msg_control = nullptr;
+  }
+}
+
+}  // namespace
+
+PacketWriter &PacketWriter::GetInstance() {
+  static thread_local PacketWriter writer;
+  return writer;
+}
+
+PacketWriter::PacketWriter()
+    : gso_enabled_(AppConfig::GetInstance().enable_gso && IsGsoSupported()),
+      txtime_enabled_(AppConfig::GetInstance().pacing == "txtime"),
+      pmtud_enabled_(AppConfig::GetInstance().pmtud_max_payload_size >
+                     AppConfig::GetInstance().max_payload_size) {
+  logger->info("UDP GSO {}", gso_enabled_ ? "enabled" : "disabled");
+}
+
+void PacketWriter::Setup(int fd) {
+  // Path MTU probes must not be fragmented. The kernel's own PMTU estimate is
+  // ignored so that probes are not refused locally.
+  int pmtud = IP_PMTUDISC_PROBE;
+  if (pmtud_enabled_ &&
+      setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtud, sizeof(pmtud)) != 0) {
+    logger->warn("failed to set IP_MTU_DISCOVER: {}, fd: {}", strerror(errno),
+                 fd);
+  }
+
+  if (!txtime_enabled_) {
+    return;
+  }
+
+  sock_txtime txtime{CLOCK_MONOTONIC, 0};
+  if (setsockopt(fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) != 0) {
+    logger->warn("failed to enable SO_TXTIME: {}, pace with timers, fd: {}",
+                 strerror(errno), fd);
+    txtime_enabled_ = false;
+  }
+}
+
+int PacketWriter::Flush(int fd, const sockaddr_storage &peer_addr,
+                        uint64_t txtime) {
+  if (count_ == 0) {
+    return 0;
+  }
+
+  txtime_ = txtime_enabled_ ? txtime : 0;
+  if (txtime_ > 0) {
+    ++txtime_flushes_;
+  }
+
+  const auto packets = packets_;
+  const auto bytes = bytes_;
+  const auto dropped = dropped_;
+  int r = count_ > 1 && gso_enabled_ && IsUniform()
+              ? SendGso(fd, peer_addr)
+              : SendBatch(fd, peer_addr, 0, 0);
+  Reset();
+
+  auto &metrics = Metrics::GetInstance();
+  metrics.Increment(Metrics::kPacketsSent, packets_ - packets);
+  metrics.Increment(Metrics::kBytesSent, bytes_ - bytes);
+  metrics.Increment(Metrics::kPacketsDropped, dropped_ - dropped);
+  if (r != 0) {
+    metrics.Increment(Metrics::kSendErrors);
+  }
+  return r;
+}
+
+bool PacketWriter::IsUniform() const noexcept {
+  const auto segment = lens_[0];
+  return std::all_of(lens_ + 1, lens_ + count_ - 1,
+                     [segment](auto len) { return len == segment; }) &&
+         lens_[count_ - 1] <= segment;
+}
+
+int PacketWriter::SendGso(int fd, const sockaddr_storage &peer_addr) {
+  const uint16_t segment = lens_[0];
+  const size_t segments_per_call =
+      std::min(kMaxPackets, kMaxGsoBytes / segment);
+  size_t first{};
+  size_t offset{};
+  while (first < count_) {
+    const auto n = std::min(segments_per_call, count_ - first);
+    size_t len{};
+    for (size_t i = first; i < first + n; ++i) {
+      len += lens_[i];
+    }
+
+    iovec iov{arena_ + offset, len};
+    msghdr msg{};
+    msg.msg_name = const_cast<sockaddr_storage *>(&peer_addr);
+    msg.msg_namelen = sizeof(peer_addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[kControlBytes]{};
+    SetControl(msg, control, n > 1 ? segment : 0, txtime_);
+
+    ++syscalls_;
+    if (sendmsg(fd, &msg, 0) < 0) {
+      if (IsTransient(errno)) {
+        dropped_ += count_ - first;
+        LOG_RATE_LIMITED(spdlog::level::warn, 10,
+                         "UDP send buffer full, drop {} packets, fd: {}",
+                         count_ - first, fd);
+        return 0;
+      }
+
+      if (n > 1 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT ||
+                    errno == EOPNOTSUPP)) {
+        logger->warn("UDP GSO failed: {}, fall back to sendmmsg, fd: {}",
+                     strerror(errno), fd);
+        gso_enabled_ = false;
+        return SendBatch(fd, peer_addr, first, offset);
+      }
+
+      if (errno == EMSGSIZE) {
+        dropped_ += count_ - first;
+        SPDLOG_LOGGER_DEBUG(
+            logger, "UDP packets of {} bytes too large, drop {}, fd: {}",
+            segment, count_ - first, fd);
+        return 0;
+      }
+
+      logger->error("failed to send: {}, fd: {}", strerror(errno), fd);
+      return -1;
+    }
+
+    if (n > 1) {
+      ++gso_syscalls_;
+    }
+    SPDLOG_LOGGER_TRACE(logger, "UDP sent {} bytes in {} segments", len, n);
+    packets_ += n;
+    bytes_ += len;
+    first += n;
+    offset += len;
+  }
+  return 0;
+}
+
+int PacketWriter::SendBatch(int fd, const sockaddr_storage &peer_addr,
+                            size_t first, size_t offset) {
+  mmsghdr msgs[kMaxPackets]{};
+  iovec iovs[kMaxPackets];
+  alignas(cmsghdr) char controls[kMaxPackets][kControlBytes]{};
+  const auto n = count_ - first;
+  for (size_t i = 0; i < n; ++i) {
+    iovs[i] = {arena_ + offset, lens_[first + i]};
+    offset += lens_[first + i];
+    auto &hdr = msgs[i].msg_hdr;
+    hdr.msg_name = const_cast<sockaddr_storage *>(&peer_addr);
+    hdr.msg_namelen = sizeof(peer_addr);
+    hdr.msg_iov = &iovs[i];
+    hdr.msg_iovlen = 1;
+    if (txtime_ > 0) {
+      SetControl(hdr, controls[i], 0, txtime_);
+    }
+  }
+
+  size_t done{};
+  while (done < n) {
+    ++syscalls_;
+    int sent = sendmmsg(fd, msgs + done, n - done, 0);
+    if (sent < 0) {
+      if (IsTransient(errno)) {
+        dropped_ += n - done;
+        LOG_RATE_LIMITED(spdlog::level::warn, 10,
+                         "UDP send buffer full, drop {} packets, fd: {}",
+                         n - done, fd);
+        return 0;
+      }
+
+      // A path MTU probe larger than the local MTU, only this one is lost.
+      if (errno == EMSGSIZE) {
+        ++dropped_;
+        SPDLOG_LOGGER_DEBUG(logger, "UDP packet of {} bytes too large, fd: {}",
+                            msgs[done].msg_hdr.msg_iov->iov_len, fd);
+        ++done;
+        continue;
+      }
+
+      logger->error("failed to send: {}, fd: {}", strerror(errno), fd);
+      return -1;
+    }
+
+    for (auto i = done; i < done + sent; ++i) {
+      bytes_ += msgs[i].msg_len;
+    }
+    SPDLOG_LOGGER_TRACE(logger, "UDP sent {} packets", sent);
+    packets_ += sent;
+    done += sent;
+  }
+  return 0;
+}
+
+void PacketWriter::Stats(evbuffer *evb) const {
+  evbuffer_add_printf(
+      evb,
+      "egress packets=%lu bytes=%lu syscalls=%lu gso_syscalls=%lu "
+      "txtime_flushes=%lu dropped=%lu packets_per_syscall=%.2f "
+      "bytes_per_packet=%.1f flush_requests=%lu flushes=%lu\n",
+      packets_, bytes_, syscalls_, gso_syscalls_, txtime_flushes_, dropped_,
+      syscalls_ == 0 ? 0.0 : static_cast<double>(packets_) / syscalls_,
+      packets_ == 0 ? 0.0 : static_cast<double>(bytes_) / packets_,
+      flush_requests_, flushes_);
+}
+
+}  // namespace quic_tunnel
@@ -0,0 +1,83 @@
+#ifndef QUIC_TUNNEL_QUIC_PACKET_WRITER_H_
+#define QUIC_TUNNEL_QUIC_PACKET_WRITER_H_
+
+#include <event2/buffer.h>
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "non_copyable.h"
+
+namespace quic_tunnel {
+
+// Collects the QUIC packets of one connection back to back in an arena and
+// sends them with as few syscalls as possible: a single UDP_SEGMENT (GSO)
+// datagram when all packets but the last share a size, sendmmsg otherwise.
+// Packets may carry a SO_TXTIME release time, which the fq qdisc honors.
+// There is one writer per thread.
+class PacketWriter : NonCopyable {
+ public:
+  static PacketWriter &GetInstance();
+
+  // Sets the DF bit if path MTU discovery is configured, and enables
+  // SO_TXTIME if txtime pacing is. If any socket does not support SO_TXTIME,
+  // pacing falls back to user space timers.
+  void Setup(int fd);
+  [[nodiscard]] bool txtime_enabled() const noexcept { return txtime_enabled_; }
+
+  [[nodiscard]] bool HasRoom(size_t len) const noexcept {
+    return count_ < kMaxPackets && size_ + len <= sizeof(arena_);
+  }
+
+  [[nodiscard]] bool empty() const noexcept { return count_ == 0; }
+  [[nodiscard]] uint8_t *tail() noexcept { return arena_ + size_; }
+
+  void Commit(size_t len) noexcept {
+    lens_[count_++] = len;
+    size_ += len;
+  }
+
+  // txtime is a CLOCK_MONOTONIC release time in nanoseconds, 0 for now.
+  int Flush(int fd, const sockaddr_storage &peer_addr, uint64_t txtime = 0);
+  void OnFlushRequested() noexcept { ++flush_requests_; }
+  void OnFlush() noexcept { ++flushes_; }
+  void Stats(evbuffer *) const;
+
+ private:
+  PacketWriter();
+
+  int SendGso(int fd, const sockaddr_storage &peer_addr);
+  int SendBatch(int fd, const sockaddr_storage &peer_addr, size_t first,
+                size_t offset);
+  [[nodiscard]] bool IsUniform() const noexcept;
+  void Reset() noexcept {
+    count_ = 0;
+    size_ = 0;
+  }
+
+  static inline constexpr size_t kMaxPackets = 64;  // UDP_MAX_SEGMENTS
+  static inline constexpr size_t kMaxGsoBytes = 65000;
+
+  bool gso_enabled_;
+  bool txtime_enabled_;
+  const bool pmtud_enabled_;
+  uint64_t txtime_{};
+  size_t count_{};
+  size_t size_{};
+  size_t lens_[kMaxPackets];
+  uint8_t arena_[256 * 1024];
+
+  size_t packets_{};
+  size_t bytes_{};
+  size_t syscalls_{};
+  size_t gso_syscalls_{};
+  size_t txtime_flushes_{};
+  size_t dropped_{};
+  size_t flush_requests_{};
+  size_t flushes_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_QUIC_PACKET_WRITER_H_
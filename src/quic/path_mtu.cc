@@ -0,0 +1,125 @@
+#include "quic/path_mtu.h"
+
+#include <algorithm>
+
+#include "log.h"
+
+namespace quic_tunnel {
+namespace {
+
+constexpr uint32_t kMinSearchStep = 16;
+constexpr size_t kMaxProbeFailures = 2;
+// Packets sent after a probe, whose acknowledgements let quiche declare the
+// probe lost.
+constexpr size_t kProbeFollowingPackets = 3;
+constexpr uint64_t kMinProbeTimeoutNanoseconds = 100 * 1000 * 1000;
+constexpr uint64_t kSearchIntervalNanoseconds = 600ull * 1000 * 1000 * 1000;
+// Packets sent at a size before its loss rate is judged.
+constexpr size_t kBlackHoleWindow = 32;
+
+}  // namespace
+
+PathMtu::PathMtu(uint32_t base_size, uint32_t max_size)
+    : base_size_(base_size),
+      max_size_(std::max(base_size, max_size)),
+      size_(base_size),
+      high_(max_size_) {}
+
+void PathMtu::Update(const quiche_stats &stats, uint64_t now) {
+  if (!enabled() || stats.rtt == 0) {
+    return;
+  }
+
+  if (probe_in_flight_) {
+    if (stats.lost > probe_lost_) {
+      OnProbeResult(false, now);
+    } else if (now >= probe_deadline_) {
+      // The stats were taken before the probe was sent, hence the 1.
+      if (stats.sent >= probe_sent_ + 1 + kProbeFollowingPackets &&
+          stats.recv > probe_recv_) {
+        OnProbeResult(true, now);
+      } else {
+        SPDLOG_LOGGER_DEBUG(logger, "path MTU probe {} bytes unanswered",
+                            probe_size_);
+        probe_in_flight_ = false;
+      }
+    }
+  }
+
+  DetectBlackHole(stats, now);
+
+  if (!probe_in_flight_ && probe_size_ == 0) {
+    if (high_ - size_ >= kMinSearchStep) {
+      probe_size_ = size_ + (high_ - size_ + 1) / 2;
+    } else if (now >= next_search_ && next_search_ != 0) {
+      high_ = max_size_;
+      next_search_ = 0;
+    }
+  }
+}
+
+uint32_t PathMtu::NextPacketSize() const noexcept {
+  return probe_in_flight_ || probe_size_ == 0 ? size_ : probe_size_;
+}
+
+void PathMtu::OnSent(size_t len, const quiche_stats &stats, uint64_t now) {
+  if (probe_in_flight_ || probe_size_ == 0 || len <= size_) {
+    return;
+  }
+
+  ++probes_;
+  probe_in_flight_ = true;
+  probe_lost_ = stats.lost;
+  probe_sent_ = stats.sent;
+  probe_recv_ = stats.recv;
+  probe_deadline_ =
+      now + std::max<uint64_t>(stats.rtt * 3, kMinProbeTimeoutNanoseconds);
+  SPDLOG_LOGGER_DEBUG(logger, "path MTU probe {} bytes", len);
+}
+
+void PathMtu::OnProbeResult(bool confirmed, uint64_t now) {
+  probe_in_flight_ = false;
+  if (confirmed) {
+    logger->info("path MTU probe {} bytes confirmed", probe_size_);
+    size_ = probe_size_;
+    probe_failures_ = 0;
+  } else if (++probe_failures_ >= kMaxProbeFailures) {
+    logger->info("path MTU probe {} bytes failed", probe_size_);
+    high_ = probe_size_ - 1;
+    probe_failures_ = 0;
+  } else {
+    return;  // Retry the same size, the loss may be unrelated.
+  }
+
+  probe_size_ = 0;
+  if (high_ - size_ < kMinSearchStep) {
+    logger->info("path MTU search done, {} bytes", size_);
+    next_search_ = now + kSearchIntervalNanoseconds;
+  }
+}
+
+void PathMtu::DetectBlackHole(const quiche_stats &stats, uint64_t now) {
+  if (stats.sent < window_sent_ + kBlackHoleWindow) {
+    return;
+  }
+
+  const auto sent = stats.sent - window_sent_;
+  const auto lost = stats.lost - window_lost_;
+  window_sent_ = stats.sent;
+  window_lost_ = stats.lost;
+  if (size_ == base_size_ || lost * 2 < sent) {
+    return;
+  }
+
+  ++black_holes_;
+  logger->warn("{} of {} packets lost at {} bytes, fall back to {} bytes",
+               lost, sent, size_, base_size_);
+  high_ = size_ - 1;
+  size_ = base_size_;
+  probe_size_ = 0;
+  probe_in_flight_ = false;
+  probe_failures_ = 0;
+  next_search_ = now + kSearchIntervalNanoseconds;
+}
+
+}  // namespace quic_tunnel
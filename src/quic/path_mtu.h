@@ -0,0 +1,64 @@
+#ifndef QUIC_TUNNEL_QUIC_PATH_MTU_H_
+#define QUIC_TUNNEL_QUIC_PATH_MTU_H_
+
+#include <quiche.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace quic_tunnel {
+
+// Packetization layer path MTU discovery in the spirit of RFC 8899. quiche
+// cannot send padding-only probes, so a probe is a regular packet that quiche
+// is allowed to build larger than the current size. The probe size is binary
+// searched between max_payload_size and pmtud_max_payload_size: a probe is
+// confirmed if no loss is reported within a few round trips while packets
+// sent after it got the peer to answer, so that loss detection had a chance
+// to run. Otherwise the probe is sent again, and a size is given up after
+// two lost probes. When most packets get lost at a size
+// above the base, the path is treated as a black hole and the size falls
+// back to the base. The search restarts periodically to find raised MTUs.
+// Times are monotonic nanoseconds.
+class PathMtu {
+ public:
+  PathMtu(uint32_t base_size, uint32_t max_size);
+
+  [[nodiscard]] bool enabled() const noexcept { return max_size_ > base_size_; }
+  [[nodiscard]] uint32_t size() const noexcept { return size_; }
+  [[nodiscard]] size_t probes() const noexcept { return probes_; }
+  [[nodiscard]] size_t black_holes() const noexcept { return black_holes_; }
+
+  void Update(const quiche_stats &stats, uint64_t now);
+  // Returns the size limit of the next packet, larger than size() if it may
+  // be a probe.
+  [[nodiscard]] uint32_t NextPacketSize() const noexcept;
+  void OnSent(size_t len, const quiche_stats &stats, uint64_t now);
+
+ private:
+  void OnProbeResult(bool confirmed, uint64_t now);
+  void DetectBlackHole(const quiche_stats &stats, uint64_t now);
+
+  const uint32_t base_size_;
+  const uint32_t max_size_;
+  uint32_t size_;
+  // The search range of sizes not yet confirmed or given up.
+  uint32_t high_;
+  uint32_t probe_size_{};
+  bool probe_in_flight_{};
+  uint64_t probe_deadline_{};
+  size_t probe_lost_{};
+  size_t probe_sent_{};
+  size_t probe_recv_{};
+  size_t probe_failures_{};
+  uint64_t next_search_{};
+
+  size_t window_sent_{};
+  size_t window_lost_{};
+
+  size_t probes_{};
+  size_t black_holes_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_QUIC_PATH_MTU_H_
@@ -5,6 +5,8 @@
 #include <memory>
 
 #include "app_config.h"
+#include "quic/packet_reader.h"
+#include "quic/packet_writer.h"
 #include "util.h"
 
 namespace quic_tunnel {
@@ -51,6 +53,8 @@ int QuicClient::UdpConnect() {
     Close();
     return -1;
   }
+  PacketReader::GetInstance().Setup(fd_);
+  PacketWriter::GetInstance().Setup(fd_);
 
   event_ = base_.NewEvent(fd_, EV_READ | EV_PERSIST, ReadCallback, this);
   if (event_->Enable() != 0) {
@@ -74,32 +78,33 @@ void QuicClient::Close() {
 
 void QuicClient::ReadCallback(int fd, short, void *arg) {
   auto *client = static_cast<QuicClient *>(arg);
-  while (true) {
-    ssize_t count = recv(fd, udp_buffer, sizeof(udp_buffer), 0);
-    if (count < 0) {
-      if (errno == EWOULDBLOCK || errno == EAGAIN) {
-        break;
-      } else {
-        logger->error("recv error: {}, fd: {}", strerror(errno), fd);
-        return;
-      }
+  auto &reader = PacketReader::GetInstance();
+  do {
+    if (reader.Read(fd) < 0) {
+      return;
     }
 
-    logger->trace("UDP recv {} bytes", count);
+    for (const auto &packet : reader.packets()) {
+      QuicHeader header;
+      if (auto r = QuicHeader::Parse(packet.data, packet.len, header); r < 0) {
+        LOG_RATE_LIMITED(spdlog::level::warn, 10, "failed to parse header: {}",
+                         r);
+        continue;
+      }
 
-    QuicHeader header;
-    if (auto r = QuicHeader::Parse(udp_buffer, count, header); r < 0) {
-      logger->warn("failed to parse header: {}", r);
-      continue;
-    }
+      if (header.dcid != client->connection_->id()) {
+        LOG_RATE_LIMITED(spdlog::level::warn, 10, "invalid cid {:spn}",
+                         spdlog::to_hex(header.dcid));
+        continue;
+      }
 
-    if (header.dcid != client->connection_->id()) {
-      logger->warn("invalid cid {:spn}", spdlog::to_hex(header.dcid));
-      continue;
+      client->connection_->Feed(packet.data, packet.len);
     }
 
-    client->connection_->OnRead(udp_buffer, count, sizeof(udp_buffer));
-  }
+    if (client->connection_->IsDrainPending()) {
+      client->connection_->Drain();
+    }
+  } while (reader.IsFull());
 }
 
 }  // namespace quic_tunnel
@@ -1,11 +1,16 @@
 #include "quic/quic_config.h"
 
+#include <algorithm>
+
+#include "app_config.h"
 #include "log.h"
 
 namespace quic_tunnel {
 
 QuicConfig::QuicConfig(const AppConfig &cfg)
-    : max_payload_size_(cfg.max_payload_size) {
+    : max_payload_size_(cfg.max_payload_size),
+      max_udp_payload_size_(
+          std::max(cfg.max_payload_size, cfg.pmtud_max_payload_size)) {
   decltype(quiche_config_) quiche_config(
       quiche_config_new(QUICHE_PROTOCOL_VERSION));
   if (!quiche_config) {
@@ -45,9 +50,9 @@ QuicConfig::QuicConfig(const AppConfig &cfg)
   quiche_config_set_disable_active_migration(quiche_config_.get(), true);
   quiche_config_set_max_idle_timeout(quiche_config_.get(), cfg.idle_timeout);
   quiche_config_set_max_recv_udp_payload_size(quiche_config_.get(),
-                                              max_payload_size_);
+                                              max_udp_payload_size_);
   quiche_config_set_max_send_udp_payload_size(quiche_config_.get(),
-                                              max_payload_size_);
+                                              max_udp_payload_size_);
   quiche_config_set_initial_max_data(quiche_config_.get(),
                                      cfg.initial_max_data);
   quiche_config_set_initial_max_stream_data_bidi_local(
@@ -56,7 +61,24 @@ QuicConfig::QuicConfig(const AppConfig &cfg)
       quiche_config_.get(), cfg.initial_max_stream_data_bidi_remote);
   quiche_config_set_initial_max_streams_bidi(quiche_config_.get(),
                                              cfg.initial_max_streams_bidi);
-  quiche_config_set_cc_algorithm(quiche_config_.get(), QUICHE_CC_CUBIC);
+  quiche_config_set_cc_algorithm(
+      quiche_config_.get(),
+      cfg.cc_algorithm == "reno" ? QUICHE_CC_RENO : QUICHE_CC_CUBIC);
+  quiche_config_enable_hystart(quiche_config_.get(), cfg.enable_hystart);
+  quiche_config_set_max_ack_delay(quiche_config_.get(), cfg.max_ack_delay);
+  quiche_config_set_ack_delay_exponent(quiche_config_.get(),
+                                       cfg.ack_delay_exponent);
+  if (cfg.protocol == "udp") {
+    quiche_config_enable_dgram(quiche_config_.get(), true, cfg.udp_queue_len,
+                               cfg.udp_queue_len);
+  }
+  logger->info(
+      "transport profile {}, cc {}, hystart {}, max ack delay {}ms, ack delay "
+      "exponent {}, max data {}, max stream data {}/{}",
+      cfg.transport_profile, cfg.cc_algorithm, cfg.enable_hystart,
+      cfg.max_ack_delay, cfg.ack_delay_exponent, cfg.initial_max_data,
+      cfg.initial_max_stream_data_bidi_local,
+      cfg.initial_max_stream_data_bidi_remote);
 }
 
 }  // namespace quic_tunnel
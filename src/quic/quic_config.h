@@ -17,12 +17,18 @@ class QuicConfig {
     return max_payload_size_;
   }
 
+  // The largest UDP payload path MTU discovery may grow packets to.
+  [[nodiscard]] auto max_udp_payload_size() const noexcept {
+    return max_udp_payload_size_;
+  }
+
   [[nodiscard]] quiche_config* GetConfig() const noexcept {
     return quiche_config_.get();
   }
 
  private:
   uint32_t max_payload_size_;
+  uint32_t max_udp_payload_size_;
   UniquePtr<quiche_config, quiche_config_free> quiche_config_;
 };
 
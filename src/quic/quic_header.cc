@@ -3,11 +3,13 @@
 #include <event2/util.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
 
 #include <chrono>
 #include <cstring>
 
 #include "log.h"
+#include "non_copyable.h"
 #include "util.h"
 
 namespace quic_tunnel {
@@ -52,138 +54,185 @@ void LogOpensslError() {
   } while (error != 0);
 }
 
-int AesGcmEncrypt0(const uint8_t *plaintext, int plaintext_len,
-                   const uint8_t *key, uint8_t *ciphertext) {
-  UniquePtr<EVP_CIPHER_CTX, EVP_CIPHER_CTX_free> ctx(EVP_CIPHER_CTX_new());
-  if (!ctx) {
-    return -1;
-  }
-
-  if (EVP_EncryptInit_ex(ctx.get(), EVP_aes_128_gcm(), nullptr, nullptr,
-                         nullptr) != 1) {
-    return -1;
-  }
-
-  evutil_secure_rng_get_bytes(ciphertext, kIvBytes);
-  if (EVP_EncryptInit_ex(ctx.get(), nullptr, nullptr, key, ciphertext) != 1) {
-    return -1;
-  }
-
-  int ciphertext_len = kIvBytes;
-  int len;
-  if (EVP_EncryptUpdate(ctx.get(), ciphertext + ciphertext_len, &len, plaintext,
-                        plaintext_len) != 1) {
-    return -1;
-  }
-  ciphertext_len += len;
-
-  if (EVP_EncryptFinal_ex(ctx.get(), ciphertext + ciphertext_len, &len) != 1) {
-    return -1;
-  }
-  ciphertext_len += len;
-
-  if (EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, kMacTagBytes,
-                          ciphertext + ciphertext_len) != 1) {
-    return -1;
-  }
-  ciphertext_len += kMacTagBytes;
-
-  logger->debug("AES GCM encryption input {} bytes output {} bytes",
-                plaintext_len, ciphertext_len);
-  return ciphertext_len;
-}
-
-int AesGcmEncrypt(const uint8_t *plaintext, int plaintext_len,
-                  const uint8_t *key, uint8_t *ciphertext) {
-  auto r = AesGcmEncrypt0(plaintext, plaintext_len, key, ciphertext);
-  if (r <= kIvBytes + kMacTagBytes) {
-    logger->error("failed to encrypt");
-    LogOpensslError();
-    return -1;
-  }
-  return r;
+constexpr int kKeyBytes = 16;
+constexpr long kKeyRotationSeconds = 600;
+
+using Key = std::array<uint8_t, kKeyBytes>;
+using CipherContext = UniquePtr<EVP_CIPHER_CTX, EVP_CIPHER_CTX_free>;
+
+// Token keys are derived from a process-wide secret and the rotation epoch,
+// so every thread derives the same keys without sharing any state.
+Key DeriveKey(long epoch) {
+  static const auto secret = [] {
+    std::array<uint8_t, 32> secret;
+    evutil_secure_rng_get_bytes(secret.data(), secret.size());
+    return secret;
+  }();
+
+  epoch = htobe64(epoch);
+  uint8_t digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len;
+  HMAC(EVP_sha256(), secret.data(), secret.size(),
+       reinterpret_cast<const uint8_t *>(&epoch), sizeof(epoch), digest,
+       &digest_len);
+  Key key;
+  memcpy(key.data(), digest, key.size());
+  return key;
 }
 
-int AesGcmDecrypt0(uint8_t *ciphertext, int ciphertext_len, const uint8_t *key,
-                   uint8_t *plaintext) {
-  UniquePtr<EVP_CIPHER_CTX, EVP_CIPHER_CTX_free> ctx(EVP_CIPHER_CTX_new());
-  if (!ctx) {
-    return -1;
+// AES-GCM contexts of a thread, keyed once per rotation epoch and then only
+// given a new IV per token. Tokens of the previous epoch are still accepted.
+class TokenCipher : NonCopyable {
+ public:
+  static TokenCipher &GetInstance() {
+    static thread_local TokenCipher cipher;
+    return cipher;
   }
 
-  if (EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_gcm(), nullptr, nullptr,
-                         nullptr) != 1) {
-    return -1;
+  int Encrypt(const uint8_t *plaintext, int plaintext_len,
+              uint8_t *ciphertext) {
+    auto r = Rotate() == 0 ? Encrypt0(plaintext, plaintext_len, ciphertext)
+                           : -1;
+    if (r <= kIvBytes + kMacTagBytes) {
+      logger->error("failed to encrypt");
+      LogOpensslError();
+      return -1;
+    }
+    return r;
   }
 
-  if (EVP_DecryptInit_ex(ctx.get(), nullptr, nullptr, key, ciphertext) != 1) {
-    return -1;
-  }
+  int Decrypt(uint8_t *ciphertext, int ciphertext_len, uint8_t *plaintext) {
+    if (ciphertext_len <= kIvBytes + kMacTagBytes) {
+      logger->error("invalid ciphertext");
+      return -1;
+    }
+
+    if (Rotate() == 0) {
+      for (auto &ctx : decrypt_ctxs_) {
+        if (auto r = Decrypt0(ctx.get(), ciphertext, ciphertext_len, plaintext);
+            r > 0) {
+          ERR_clear_error();
+          return r;
+        }
+      }
+    }
 
-  int plaintext_len;
-  if (EVP_DecryptUpdate(ctx.get(), plaintext, &plaintext_len,
-                        ciphertext + kIvBytes,
-                        ciphertext_len - kIvBytes - kMacTagBytes) != 1) {
+    logger->error("failed to decrypt");
+    LogOpensslError();
     return -1;
   }
 
-  if (EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, kMacTagBytes,
-                          ciphertext + ciphertext_len - kMacTagBytes) != 1) {
-    return -1;
+ private:
+  TokenCipher()
+      : encrypt_ctx_(EVP_CIPHER_CTX_new()),
+        decrypt_ctxs_{CipherContext(EVP_CIPHER_CTX_new()),
+                      CipherContext(EVP_CIPHER_CTX_new())} {}
+
+  int Rotate() {
+    auto epoch = SecondsSinceEpoch() / kKeyRotationSeconds;
+    if (epoch == epoch_) {
+      return 0;
+    }
+
+    if (!encrypt_ctx_ || !decrypt_ctxs_[0] || !decrypt_ctxs_[1]) {
+      return -1;
+    }
+
+    auto current = DeriveKey(epoch);
+    auto previous = DeriveKey(epoch - 1);
+    if (EVP_EncryptInit_ex(encrypt_ctx_.get(), EVP_aes_128_gcm(), nullptr,
+                           current.data(), nullptr) != 1 ||
+        EVP_DecryptInit_ex(decrypt_ctxs_[0].get(), EVP_aes_128_gcm(),
+                           nullptr, current.data(), nullptr) != 1 ||
+        EVP_DecryptInit_ex(decrypt_ctxs_[1].get(), EVP_aes_128_gcm(),
+                           nullptr, previous.data(), nullptr) != 1) {
+      return -1;
+    }
+
+    SPDLOG_LOGGER_DEBUG(logger, "token key rotated, epoch {}", epoch);
+    epoch_ = epoch;
+    return 0;
   }
 
-  int len;
-  if (EVP_DecryptFinal_ex(ctx.get(), plaintext + plaintext_len, &len) != 1) {
-    return -1;
+  int Encrypt0(const uint8_t *plaintext, int plaintext_len,
+               uint8_t *ciphertext) {
+    auto *ctx = encrypt_ctx_.get();
+    evutil_secure_rng_get_bytes(ciphertext, kIvBytes);
+    if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, ciphertext) != 1) {
+      return -1;
+    }
+
+    int ciphertext_len = kIvBytes;
+    int len;
+    if (EVP_EncryptUpdate(ctx, ciphertext + ciphertext_len, &len, plaintext,
+                          plaintext_len) != 1) {
+      return -1;
+    }
+    ciphertext_len += len;
+
+    if (EVP_EncryptFinal_ex(ctx, ciphertext + ciphertext_len, &len) != 1) {
+      return -1;
+    }
+    ciphertext_len += len;
+
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, kMacTagBytes,
+                            ciphertext + ciphertext_len) != 1) {
+      return -1;
+    }
+    ciphertext_len += kMacTagBytes;
+
+    SPDLOG_LOGGER_DEBUG(logger,
+                        "AES GCM encryption input {} bytes output {} bytes",
+                        plaintext_len, ciphertext_len);
+    return ciphertext_len;
   }
-  plaintext_len += len;
-
-  logger->debug("AES GCM decryption input {} bytes output {} bytes",
-                ciphertext_len, plaintext_len);
-  return plaintext_len;
-}
 
-int AesGcmDecrypt(uint8_t *ciphertext, int ciphertext_len, const uint8_t *key,
-                  uint8_t *plaintext) {
-  if (ciphertext_len <= kIvBytes + kMacTagBytes) {
-    logger->error("invalid ciphertext");
-    return -1;
+  static int Decrypt0(EVP_CIPHER_CTX *ctx, uint8_t *ciphertext,
+                      int ciphertext_len, uint8_t *plaintext) {
+    if (EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, ciphertext) != 1) {
+      return -1;
+    }
+
+    int plaintext_len;
+    if (EVP_DecryptUpdate(ctx, plaintext, &plaintext_len,
+                          ciphertext + kIvBytes,
+                          ciphertext_len - kIvBytes - kMacTagBytes) != 1) {
+      return -1;
+    }
+
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, kMacTagBytes,
+                            ciphertext + ciphertext_len - kMacTagBytes) != 1) {
+      return -1;
+    }
+
+    int len;
+    if (EVP_DecryptFinal_ex(ctx, plaintext + plaintext_len, &len) != 1) {
+      return -1;
+    }
+    plaintext_len += len;
+
+    SPDLOG_LOGGER_DEBUG(logger,
+                        "AES GCM decryption input {} bytes output {} bytes",
+                        ciphertext_len, plaintext_len);
+    return plaintext_len;
   }
 
-  auto r = AesGcmDecrypt0(ciphertext, ciphertext_len, key, plaintext);
-  if (r <= 0) {
-    logger->error("failed to decrypt");
-    LogOpensslError();
-    return -1;
-  }
-  return r;
-}
-
-constexpr int kKeyBytes = 16;
-
-auto GenerateRandomKey() {
-  std::array<uint8_t, kKeyBytes> key;
-  evutil_secure_rng_get_bytes(key.data(), key.size());
-  return key;
-}
-
-const uint8_t *GetKey() {
-  static const auto key = GenerateRandomKey();
-  return key.data();
-}
+  CipherContext encrypt_ctx_;
+  CipherContext decrypt_ctxs_[2];  // current and previous epoch
+  long epoch_{-1};
+};
 
 }  // namespace
 
 int QuicHeader::Parse(const uint8_t *buf, size_t buf_len, QuicHeader &header) {
   size_t scid_len = header.scid.size();
-  size_t dcid_len = header.dcid.size();
+  header.dcid_len = header.dcid.size();
   header.token_len = sizeof(header.token);
   int r = quiche_header_info(buf, buf_len, kConnectionIdBytes, &header.version,
                              &header.type, header.scid.data(), &scid_len,
-                             header.dcid.data(), &dcid_len, header.token,
-                             &header.token_len);
+                             header.dcid.data(), &header.dcid_len,
+                             header.token, &header.token_len);
   assert(scid_len == header.scid.size() || scid_len == 0);
-  assert(dcid_len == header.dcid.size());
   return r;
 }
 
@@ -195,7 +244,7 @@ int QuicHeader::MintToken(const sockaddr_storage &addr) {
   auto seconds = SecondsSinceEpoch();
 
   token_len = FillBuffer(buf, ip, port, scid, dcid, seconds);
-  auto len = AesGcmEncrypt(buf, token_len, GetKey(), token);
+  auto len = TokenCipher::GetInstance().Encrypt(buf, token_len, token);
   if (len < 0) {
     return -1;
   }
@@ -211,7 +260,7 @@ bool QuicHeader::ValidateToken(const sockaddr_storage &addr,
   }
 
   uint8_t buf[kTokenBytes];
-  auto len = AesGcmDecrypt(token, token_len, GetKey(), buf);
+  auto len = TokenCipher::GetInstance().Decrypt(token, token_len, buf);
   if (len < 0) {
     return false;
   }
@@ -9,6 +9,7 @@
 namespace quic_tunnel {
 
 inline constexpr int kConnectionIdBytes = 16;
+inline constexpr uint8_t kInitialPacketType = 1;
 
 inline constexpr int kIvBytes = 12;
 inline constexpr int kMacTagBytes = 16;
@@ -24,6 +25,8 @@ struct QuicHeader {
   size_t token_len;
   ConnectionId scid;
   ConnectionId dcid;
+  // Of long headers, which carry the length chosen by the client.
+  size_t dcid_len;
   uint8_t token[kTokenBytes];
 
   [[nodiscard]] static int Parse(const uint8_t *buf, size_t buf_len,
@@ -1,7 +1,13 @@
 #include "quic/quic_server.h"
 
+#include <linux/filter.h>
 #include <spdlog/fmt/bin_to_hex.h>
 
+#include <algorithm>
+
+#include "metrics.h"
+#include "quic/packet_reader.h"
+#include "quic/packet_writer.h"
 #include "quic/quic_header.h"
 #include "util.h"
 
@@ -9,30 +15,43 @@ namespace quic_tunnel {
 
 namespace {
 
+// Packets queued for another worker, beyond which they are dropped, so that
+// a worker falling behind cannot be flooded through the forwarding path.
+constexpr size_t kMaxForwardedPackets = 4096;
+
 int NegotiateVersion(const QuicHeader &header, int fd,
                      const sockaddr_storage &peer_addr,
                      uint32_t max_payload_size) {
   ssize_t written = quiche_negotiate_version(
       header.scid.data(), header.scid.size(), header.dcid.data(),
-      header.dcid.size(), quic_buffer, max_payload_size);
+      header.dcid_len, quic_buffer, max_payload_size);
   if (written <= 0) {
     logger->error("failed to create version negotiate packet: {}, fd: {}",
                   written, fd);
     return -1;
   }
+  Metrics::GetInstance().Increment(Metrics::kVersionNegotiations);
   return SendTo(fd, quic_buffer, written, peer_addr);
 }
 
+// The first byte of a connection ID modulo the number of workers is the index
+// of the worker owning the connection.
+size_t WorkerIndex(const ConnectionId &cid, size_t workers) {
+  return cid[0] % workers;
+}
+
 int StatelessRetry(QuicHeader &header, int fd,
-                   const sockaddr_storage &peer_addr,
-                   uint32_t max_payload_size) {
+                   const sockaddr_storage &peer_addr, uint32_t max_payload_size,
+                   size_t worker_index, size_t workers) {
   if (header.MintToken(peer_addr) != 0) {
     return -1;
   }
 
   ConnectionId new_cid;
   evutil_secure_rng_get_bytes(new_cid.data(), new_cid.size());
-  logger->debug("new cid {:spn}", spdlog::to_hex(new_cid));
+  int first = new_cid[0] - WorkerIndex(new_cid, workers) + worker_index;
+  new_cid[0] = first > UINT8_MAX ? first - workers : first;
+  SPDLOG_LOGGER_DEBUG(logger, "new cid {:spn}", spdlog::to_hex(new_cid));
 
   ssize_t written = quiche_retry(
       header.scid.data(), header.scid.size(), header.dcid.data(),
@@ -42,6 +61,7 @@ int StatelessRetry(QuicHeader &header, int fd,
     logger->error("failed to create retry packet: {}, fd: {}", written, fd);
     return -1;
   }
+  Metrics::GetInstance().Increment(Metrics::kRetries);
   return SendTo(fd, quic_buffer, written, peer_addr);
 }
 
@@ -59,6 +79,13 @@ QuicServer::QuicServer(const QuicConfig &quic_config, EventBase &base,
           },
           this)) {}
 
+void QuicServer::JoinGroup(const std::vector<QuicServer *> &group,
+                           size_t index) {
+  group_ = group;
+  index_ = index;
+  forward_event_ = base_.NewEvent(-1, 0, ForwardCallback, this);
+}
+
 int QuicServer::Bind() {
   fd_ = socket(AF_INET, SOCK_DGRAM, 0);
   if (fd_ == -1) {
@@ -66,11 +93,23 @@ int QuicServer::Bind() {
     return -1;
   }
 
+  if (group_.size() > 1) {
+    int enabled = 1;
+    if (setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled)) !=
+        0) {
+      logger->error("failed to set SO_REUSEPORT: {}", strerror(errno));
+      Close();
+      return -1;
+    }
+  }
+
   if (evutil_make_socket_nonblocking(fd_) != 0) {
     logger->error("failed to make socket non-blocking: {}", strerror(errno));
     Close();
     return -1;
   }
+  PacketReader::GetInstance().Setup(fd_);
+  PacketWriter::GetInstance().Setup(fd_);
 
   const auto &cfg = AppConfig::GetInstance();
   if (bind(fd_, reinterpret_cast<const sockaddr *>(&cfg.bind_addr),
@@ -81,6 +120,13 @@ int QuicServer::Bind() {
     return -1;
   }
 
+  if (group_.size() > 1 && index_ == 0 && AttachSteeringProgram() != 0) {
+    logger->warn(
+        "failed to attach reuseport program: {}, forward packets to their "
+        "workers in user space",
+        strerror(errno));
+  }
+
   event_ = base_.NewEvent(fd_, EV_READ | EV_PERSIST, ReadCallback, this);
   if (event_->Enable() != 0) {
     Close();
@@ -91,13 +137,30 @@ int QuicServer::Bind() {
   return 0;
 }
 
+int QuicServer::AttachSteeringProgram() {
+  // Picks the socket indexed by the first destination connection ID byte
+  // modulo the number of workers. It is at offset 6 of a long header packet,
+  // and at offset 1 of a short header packet.
+  sock_filter code[] = {
+      {BPF_LD | BPF_B | BPF_ABS, 0, 0, 0},
+      {BPF_JMP | BPF_JSET | BPF_K, 0, 2, 0x80},
+      {BPF_LD | BPF_B | BPF_ABS, 0, 0, 6},
+      {BPF_JMP | BPF_JA, 0, 0, 1},
+      {BPF_LD | BPF_B | BPF_ABS, 0, 0, 1},
+      {BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(group_.size())},
+      {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  sock_fprog prog{sizeof(code) / sizeof(code[0]), code};
+  return setsockopt(fd_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                    sizeof(prog));
+}
+
 void QuicServer::Close() {
   if (fd_ > 0) {
     logger->info("closing {} connections", connections_.size());
-    for (const auto &pair : connections_) {
-      pair.second.first->Close();
-    }
-    connections_.clear();
+    connections_.ForEach(
+        [](const ConnectionId &, auto &pair) { pair.first->Close(); });
+    connections_.Clear();
 
     if (close(fd_) != 0) {
       logger->error("close fd {} failed: {}", fd_, strerror(errno));
@@ -106,23 +169,42 @@ void QuicServer::Close() {
   }
 }
 
-auto QuicServer::Handshake(QuicHeader &header,
-                           const sockaddr_storage &peer_addr, int fd) {
+Connection *QuicServer::Handshake(QuicHeader &header,
+                                  const sockaddr_storage &peer_addr, int fd) {
   if (!quiche_version_is_supported(header.version)) {
     NegotiateVersion(header, fd, peer_addr, quic_config_.max_payload_size());
-    return connections_.end();
+    return nullptr;
   }
 
-  if (header.token_len == 0) {
-    StatelessRetry(header, fd, peer_addr, quic_config_.max_payload_size());
-    return connections_.end();
+  // Connection IDs, and the original ones in Retry tokens, are all
+  // kConnectionIdBytes long, so a client choosing another length is dropped.
+  if (header.dcid_len != kConnectionIdBytes) {
+    LOG_RATE_LIMITED(spdlog::level::warn, 10,
+                     "drop packet with {} bytes dcid, client addr {}",
+                     header.dcid_len, ToString(peer_addr));
+    return nullptr;
   }
 
-  ConnectionId odcid;
-  if (!header.ValidateToken(peer_addr, odcid)) {
+  // Without Retry the connection keeps the client chosen ID, which steers
+  // to this worker as well.
+  std::optional<ConnectionId> odcid;
+  if (header.token_len == 0) {
+    if (address_validator_.RequiresRetry(peer_addr)) {
+      StatelessRetry(header, fd, peer_addr, quic_config_.max_payload_size(),
+                     index_, std::max<size_t>(group_.size(), 1));
+      return nullptr;
+    }
+
+    if (header.type != kInitialPacketType) {
+      SPDLOG_LOGGER_DEBUG(logger,
+                          "drop packet type {:d} of unknown connection {:spn}",
+                          header.type, spdlog::to_hex(header.dcid));
+      return nullptr;
+    }
+  } else if (!header.ValidateToken(peer_addr, odcid.emplace())) {
     logger->warn("invalid address validation token, client addr {}",
                  ToString(peer_addr));
-    return connections_.end();
+    return nullptr;
   }
 
   auto connection =
@@ -130,17 +212,24 @@ auto QuicServer::Handshake(QuicHeader &header,
   auto connection_callbacks = connection_callbacks_factory_.Create();
   connection->AddConnectionCallbacks(*connection_callbacks);
   if (connection->Accept(header.dcid, odcid, header.scid) != 0) {
-    return connections_.end();
+    return nullptr;
   }
+  address_validator_.OnHandshakeStarted();
+
+  auto *conn = connection.get();
+  connections_.Emplace(conn->id(), {std::move(connection),
+                                    std::move(connection_callbacks)});
+  return conn;
+}
 
-  auto conn_id = connection->id();
-  auto pair = connections_.emplace(
-      conn_id,
-      std::make_pair(std::move(connection), std::move(connection_callbacks)));
-  return pair.first;
+void QuicServer::OnConnected(Connection &connection) {
+  address_validator_.OnHandshakeFinished(connection.peer_addr(), true);
 }
 
 void QuicServer::OnClosed(Connection &connection) {
+  if (!connection.IsEstablished()) {
+    address_validator_.OnHandshakeFinished(connection.peer_addr(), false);
+  }
   closed_connection_ids_.emplace_back(connection.id());
   timer_.Enable(0);
 }
@@ -148,49 +237,110 @@ void QuicServer::OnClosed(Connection &connection) {
 void QuicServer::RemoveClosedConnections() {
   for (auto iter = closed_connection_ids_.cbegin();
        iter != closed_connection_ids_.cend();) {
-    connections_.erase(*iter);
+    connections_.Erase(*iter);
     iter = closed_connection_ids_.erase(iter);
   }
 }
 
 void QuicServer::ReadCallback(int fd, short, void *arg) {
   auto *server = static_cast<QuicServer *>(arg);
-  sockaddr_storage peer_addr{};
-  socklen_t peer_addr_len = sizeof(peer_addr);
-  while (true) {
-    auto count =
-        recvfrom(fd, udp_buffer, sizeof(udp_buffer), 0,
-                 reinterpret_cast<sockaddr *>(&peer_addr), &peer_addr_len);
-    if (count < 0) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        break;
-      } else {
-        logger->error("recvfrom error: {}, fd: {}", strerror(errno), fd);
-        return;
-      }
+  auto &reader = PacketReader::GetInstance();
+  do {
+    if (reader.Read(fd) < 0) {
+      return;
+    }
+
+    for (const auto &packet : reader.packets()) {
+      server->OnPacket(packet.data, packet.len, *packet.peer_addr);
     }
-    logger->trace("UDP recv {} bytes", count);
+    server->DrainConnections();
+  } while (reader.IsFull());
+}
+
+void QuicServer::OnPacket(uint8_t *buf, size_t len,
+                          const sockaddr_storage &peer_addr) {
+  QuicHeader header;
+  if (auto r = QuicHeader::Parse(buf, len, header); r < 0) {
+    LOG_RATE_LIMITED(spdlog::level::warn, 10,
+                     "failed to parse header: {}, client addr {}", r,
+                     ToString(peer_addr));
+    return;
+  }
+
+  SPDLOG_LOGGER_TRACE(
+      logger, "QUIC header: type={:d} version={} scid={:spn} dcid={:spn}",
+      header.type, header.version, spdlog::to_hex(header.scid),
+      spdlog::to_hex(header.dcid));
 
-    QuicHeader header;
-    if (auto r = QuicHeader::Parse(udp_buffer, count, header); r < 0) {
-      logger->warn("failed to parse header: {}, client addr {}", r,
-                   ToString(peer_addr));
-      continue;
+  if (group_.size() > 1) {
+    if (auto owner = WorkerIndex(header.dcid, group_.size()); owner != index_) {
+      group_[owner]->Forward(buf, len, peer_addr);
+      return;
     }
+  }
 
-    logger->trace("QUIC header: type={:d} version={} scid={:spn} dcid={:spn}",
-                  header.type, header.version, spdlog::to_hex(header.scid),
-                  spdlog::to_hex(header.dcid));
+  Connection *connection;
+  if (auto *pair = connections_.Find(header.dcid); pair) {
+    connection = pair->first.get();
+  } else {
+    connection = Handshake(header, peer_addr, fd_);
+    if (!connection) {
+      return;
+    }
+  }
+  const bool drain_pending = connection->IsDrainPending();
+  if (connection->Feed(buf, len) == 0 && !drain_pending) {
+    fed_connections_.emplace_back(connection);
+  }
+}
 
-    auto iter = server->connections_.find(header.dcid);
-    if (iter == server->connections_.end()) {
-      iter = server->Handshake(header, peer_addr, fd);
-      if (iter == server->connections_.end()) {
-        continue;
-      }
+void QuicServer::DrainConnections() {
+  for (auto *connection : fed_connections_) {
+    connection->Drain();
+  }
+  fed_connections_.clear();
+}
+
+void QuicServer::Forward(const uint8_t *buf, size_t len,
+                         const sockaddr_storage &peer_addr) {
+  bool empty;
+  bool full;
+  {
+    std::lock_guard lock(forward_mutex_);
+    empty = forwarded_packets_.empty();
+    full = forwarded_packets_.size() >= kMaxForwardedPackets;
+    if (!full) {
+      forwarded_packets_.push_back({{buf, buf + len}, peer_addr});
     }
-    iter->second.first->OnRead(udp_buffer, count, sizeof(udp_buffer));
   }
+
+  if (full) {
+    Metrics::GetInstance().Increment(Metrics::kPacketsDropped);
+    LOG_RATE_LIMITED(spdlog::level::warn, 10,
+                     "forward queue of worker {} full, drop packet", index_);
+    return;
+  }
+
+  if (empty) {
+    forward_event_->Activate();
+  }
+}
+
+void QuicServer::ForwardCallback(int, short, void *arg) {
+  auto *server = static_cast<QuicServer *>(arg);
+  std::vector<ForwardedPacket> packets;
+  {
+    std::lock_guard lock(server->forward_mutex_);
+    packets.swap(server->forwarded_packets_);
+  }
+
+  SPDLOG_LOGGER_TRACE(logger, "{} packets forwarded to worker {}",
+                      packets.size(), server->index_);
+  for (auto &packet : packets) {
+    server->OnPacket(packet.data.data(), packet.data.size(),
+                     packet.peer_addr);
+  }
+  server->DrainConnections();
 }
 
 }  // namespace quic_tunnel
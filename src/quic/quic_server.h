@@ -1,10 +1,13 @@
 #ifndef QUIC_TUNNEL_QUIC_QUIC_SERVER_H_
 #define QUIC_TUNNEL_QUIC_QUIC_SERVER_H_
 
-#include <map>
+#include <mutex>
+#include <vector>
 
+#include "quic/address_validator.h"
 #include "quic/connection.h"
 #include "quic/connection_callbacks_factory.h"
+#include "quic/connection_table.h"
 
 namespace quic_tunnel {
 
@@ -14,17 +17,34 @@ class QuicServer : NonCopyable, public ConnectionCallbacks {
              ConnectionCallbacksFactory &connection_callbacks_factory);
   ~QuicServer() override { Close(); }
 
+  // Makes this server worker index of a SO_REUSEPORT group. Connection IDs
+  // minted here encode the index, so every packet of a connection is steered
+  // to its owning worker by a reuseport BPF program, or forwarded to it in
+  // user space if the program cannot be attached.
+  void JoinGroup(const std::vector<QuicServer *> &group, size_t index);
   int Bind();
 
  private:
-  void OnConnected(Connection &) override {}
+  void OnConnected(Connection &) override;
   void OnClosed(Connection &) override;
   void OnStreamRead(StreamId, const uint8_t *, size_t, bool) override {}
-  void OnStreamWrite(StreamId) override {}
-  [[nodiscard]] bool ReportWritableStreams() const override { return false; }
+  void OnWritable() override {}
+  void OnDatagramRead(const uint8_t *, size_t) override {}
+
+  struct ForwardedPacket {
+    std::vector<uint8_t> data;
+    sockaddr_storage peer_addr;
+  };
 
   static void ReadCallback(int, short, void *);
-  auto Handshake(QuicHeader &header, const sockaddr_storage &peer_addr, int fd);
+  static void ForwardCallback(int, short, void *);
+  void OnPacket(uint8_t *buf, size_t len, const sockaddr_storage &peer_addr);
+  void DrainConnections();
+  void Forward(const uint8_t *buf, size_t len,
+               const sockaddr_storage &peer_addr);
+  int AttachSteeringProgram();
+  Connection *Handshake(QuicHeader &header, const sockaddr_storage &peer_addr,
+                        int fd);
   void RemoveClosedConnections();
   void Close();
 
@@ -36,10 +56,19 @@ class QuicServer : NonCopyable, public ConnectionCallbacks {
   Timer timer_;
 
   using ConnectionMap =
-      std::map<ConnectionId, std::pair<std::unique_ptr<Connection>,
-                                       std::unique_ptr<ConnectionCallbacks>>>;
+      ConnectionTable<std::pair<std::unique_ptr<Connection>,
+                                std::unique_ptr<ConnectionCallbacks>>>;
   ConnectionMap connections_;
   std::list<ConnectionId> closed_connection_ids_;
+  AddressValidator address_validator_;
+  // Connections fed by the current receive batch, to be drained once.
+  std::vector<Connection *> fed_connections_;
+
+  std::vector<QuicServer *> group_;
+  size_t index_{};
+  std::unique_ptr<Event> forward_event_;
+  std::mutex forward_mutex_;
+  std::vector<ForwardedPacket> forwarded_packets_;
 };
 
 }  // namespace quic_tunnel
@@ -0,0 +1,71 @@
+#ifndef QUIC_TUNNEL_RECORD_H_
+#define QUIC_TUNNEL_RECORD_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace quic_tunnel {
+
+// Layout of the binary record files, shared by RecordLog and the decoder. A
+// file starts with a RecordFileHeader followed by fixed-size records in the
+// byte order of the host. The file is preallocated, so the records end at the
+// first one of type kNone, or at the end of the file.
+
+// The first 8 bytes of a file, without the null.
+inline constexpr char kRecordMagic[] = "QTRECORD";
+inline constexpr uint32_t kRecordVersion = 1;
+
+struct RecordFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint8_t reserved[48];
+};
+
+struct Record {
+  enum Type : uint8_t {
+    kNone,
+    kStream,
+    kConnection,
+  };
+
+  enum CloseReason : uint8_t {
+    kLocalClosed,
+    // By the peer, or for a connection also by the idle timeout.
+    kRemoteClosed,
+    // Streams only, closed along with their QUIC connection.
+    kConnectionClosed,
+    // Connections only.
+    kHandshakeFailed,
+  };
+
+  static inline constexpr size_t kMaxCidBytes = 20;
+  static inline constexpr size_t kMaxHostBytes = 96;
+
+  Type type;
+  CloseReason close_reason;
+  uint8_t cid_len;
+  uint8_t host_len;
+  uint8_t cid[kMaxCidBytes];
+  uint64_t stream_id;
+  // Nanoseconds since the epoch.
+  uint64_t start_time;
+  uint64_t end_time;
+  // Stream payload of a stream, UDP payload of a connection.
+  uint64_t recv_bytes;
+  uint64_t sent_bytes;
+  // Of the QUIC connection when the record was written.
+  uint64_t rtt;  // nanoseconds
+  uint64_t cwnd;
+  uint64_t lost;  // packets
+  uint64_t delivery_rate;  // bytes/s
+  // Truncated to kMaxHostBytes, not null-terminated.
+  char host[kMaxHostBytes];
+};
+
+static_assert(sizeof(RecordFileHeader) == 64);
+static_assert(sizeof(Record) == 192);
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_RECORD_H_
@@ -0,0 +1,117 @@
+#include "record_log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "app_config.h"
+#include "log.h"
+
+namespace quic_tunnel {
+
+RecordLog &RecordLog::GetInstance() {
+  static thread_local RecordLog records;
+  return records;
+}
+
+uint64_t RecordLog::Now() noexcept {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+RecordLog::RecordLog() {
+  const auto &cfg = AppConfig::GetInstance();
+  if (cfg.record_file.empty()) {
+    return;
+  }
+
+  static std::atomic<uint32_t> threads{};
+  path_ = cfg.record_file + "." + std::to_string(threads++);
+  max_files_ = cfg.record_files;
+  capacity_ =
+      (cfg.record_file_size - sizeof(RecordFileHeader)) / sizeof(Record);
+  // The file of the last run is rotated rather than overwritten.
+  if (Rotate() == 0) {
+    logger->info("record log {}, {} records per file", path_, capacity_);
+  }
+}
+
+RecordLog::~RecordLog() { Close(); }
+
+std::string RecordLog::FileName(uint32_t n) const {
+  return n == 0 ? path_ : path_ + "." + std::to_string(n);
+}
+
+int RecordLog::Open() {
+  const auto path = FileName(0);
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ == -1) {
+    logger->error("failed to open {}: {}", path, strerror(errno));
+    return -1;
+  }
+
+  // Allocated up front, so that a full disk fails here rather than with a
+  // SIGBUS when a page of the mapping is first written.
+  const auto size = sizeof(RecordFileHeader) + capacity_ * sizeof(Record);
+  if (auto r = posix_fallocate(fd_, 0, size); r != 0) {
+    logger->error("failed to allocate {} bytes for {}: {}", size, path,
+                  strerror(r));
+    close(fd_);
+    fd_ = -1;
+    return -1;
+  }
+
+  data_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (data_ == MAP_FAILED) {
+    logger->error("failed to map {}: {}", path, strerror(errno));
+    data_ = nullptr;
+    close(fd_);
+    fd_ = -1;
+    return -1;
+  }
+
+  auto *header = static_cast<RecordFileHeader *>(data_);
+  memcpy(header->magic, kRecordMagic, sizeof(header->magic));
+  header->version = kRecordVersion;
+  header->record_size = sizeof(Record);
+  records_ = reinterpret_cast<Record *>(header + 1);
+  count_ = 0;
+  return 0;
+}
+
+void RecordLog::Close() {
+  if (!data_) {
+    return;
+  }
+
+  munmap(data_, sizeof(RecordFileHeader) + capacity_ * sizeof(Record));
+  data_ = nullptr;
+  records_ = nullptr;
+  if (ftruncate(fd_, sizeof(RecordFileHeader) + count_ * sizeof(Record)) !=
+      0) {
+    logger->warn("failed to truncate {}: {}", path_, strerror(errno));
+  }
+  close(fd_);
+  fd_ = -1;
+}
+
+int RecordLog::Rotate() {
+  Close();
+  for (auto n = max_files_ - 1; n > 0; --n) {
+    if (rename(FileName(n - 1).c_str(), FileName(n).c_str()) != 0 &&
+        errno != ENOENT) {
+      logger->warn("failed to rotate {}: {}", FileName(n - 1),
+                   strerror(errno));
+    }
+  }
+  return Open();
+}
+
+}  // namespace quic_tunnel
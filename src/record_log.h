@@ -0,0 +1,54 @@
+#ifndef QUIC_TUNNEL_RECORD_LOG_H_
+#define QUIC_TUNNEL_RECORD_LOG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "non_copyable.h"
+#include "record.h"
+
+namespace quic_tunnel {
+
+// Appends a Record for every closed stream and QUIC connection to a binary
+// file, see record_file in the conf. Each thread has its own file, named
+// record_file.<thread>, which is preallocated and memory-mapped, so writing a
+// record is a copy into the page cache. A full file is truncated to its
+// records and rotated to record_file.<thread>.1, .2 and so on, like the
+// rotating log.
+class RecordLog : NonCopyable {
+ public:
+  static RecordLog &GetInstance();
+  // Nanoseconds since the epoch.
+  static uint64_t Now() noexcept;
+
+  [[nodiscard]] bool enabled() const noexcept { return records_ != nullptr; }
+
+  void Write(const Record &record) noexcept {
+    if (count_ == capacity_ && Rotate() != 0) {
+      return;
+    }
+    records_[count_++] = record;
+  }
+
+ private:
+  RecordLog();
+  ~RecordLog();
+
+  [[nodiscard]] std::string FileName(uint32_t n) const;
+  int Open();
+  void Close();
+  int Rotate();
+
+  std::string path_;
+  uint32_t max_files_{};
+  size_t capacity_{};
+  int fd_{-1};
+  void *data_{};
+  Record *records_{};
+  size_t count_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_RECORD_LOG_H_
@@ -0,0 +1,115 @@
+#ifndef QUIC_TUNNEL_RING_BUFFER_H_
+#define QUIC_TUNNEL_RING_BUFFER_H_
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "non_copyable.h"
+
+namespace quic_tunnel {
+
+// A byte ring of a power of 2 capacity, read and written in place through at
+// most two contiguous spans, so that readv and writev move bytes between the
+// ring and a socket without another copy. The storage is allocated when first
+// reserved and kept until the ring is destroyed, so a busy stream does not
+// allocate per read. Draining the ring empty rewinds it, which keeps the
+// next read in a single span.
+class RingBuffer : NonCopyable {
+ public:
+  RingBuffer() : data_() {}
+
+  [[nodiscard]] size_t size() const noexcept { return tail_ - head_; }
+  [[nodiscard]] bool empty() const noexcept { return tail_ == head_; }
+  [[nodiscard]] size_t capacity() const noexcept { return capacity_; }
+
+  // Makes room for at least n more bytes, keeping the buffered ones.
+  void Reserve(size_t n) {
+    const auto size = this->size();
+    if (data_ && capacity_ - size >= n) {
+      return;
+    }
+
+    size_t capacity = std::max(capacity_, kMinCapacity);
+    while (capacity - size < n) {
+      capacity *= 2;
+    }
+
+    std::unique_ptr<uint8_t[]> data(new uint8_t[capacity]);
+    iovec spans[2];
+    size_t offset{};
+    for (int i = 0; i < ReadableSpans(spans, size); ++i) {
+      memcpy(data.get() + offset, spans[i].iov_base, spans[i].iov_len);
+      offset += spans[i].iov_len;
+    }
+    data_ = std::move(data);
+    capacity_ = capacity;
+    head_ = 0;
+    tail_ = size;
+  }
+
+  // Fills spans with up to max of the buffered bytes, oldest first, and
+  // returns the number of spans.
+  int ReadableSpans(iovec spans[2], size_t max) const noexcept {
+    return Spans(spans, head_, std::min(max, size()));
+  }
+
+  // Fills spans with up to max bytes of the free space, which must have been
+  // reserved, and returns the number of spans.
+  int WritableSpans(iovec spans[2], size_t max) noexcept {
+    return Spans(spans, tail_, std::min(max, capacity_ - size()));
+  }
+
+  // Marks n bytes written into the writable spans as buffered.
+  void Produce(size_t n) noexcept { tail_ += n; }
+
+  // Drops the oldest n buffered bytes.
+  void Consume(size_t n) noexcept {
+    head_ += n;
+    if (head_ == tail_) {
+      head_ = tail_ = 0;
+    }
+  }
+
+  void Append(const uint8_t *buf, size_t len) {
+    Reserve(len);
+    iovec spans[2];
+    for (int i = 0; i < WritableSpans(spans, len); ++i) {
+      memcpy(spans[i].iov_base, buf, spans[i].iov_len);
+      buf += spans[i].iov_len;
+    }
+    Produce(len);
+  }
+
+ private:
+  static inline constexpr size_t kMinCapacity = 16 * 1024;
+
+  int Spans(iovec spans[2], uint64_t from, size_t len) const noexcept {
+    if (len == 0) {
+      return 0;
+    }
+
+    const auto offset = from & (capacity_ - 1);
+    const auto first = std::min(len, capacity_ - offset);
+    spans[0] = {data_.get() + offset, first};
+    if (first == len) {
+      return 1;
+    }
+    spans[1] = {data_.get(), len - first};
+    return 2;
+  }
+
+  std::unique_ptr<uint8_t[]> data_;
+  size_t capacity_{};
+  // Positions of the oldest and next byte, masked by capacity_ - 1.
+  uint64_t head_{};
+  uint64_t tail_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_RING_BUFFER_H_
@@ -0,0 +1,66 @@
+#include "stream_classifier.h"
+
+#include <strings.h>
+
+#include <algorithm>
+
+namespace quic_tunnel {
+namespace {
+
+std::string_view StripPort(std::string_view host) {
+  if (!host.empty() && host.front() == '[') {
+    auto end = host.find(']');
+    return end == std::string_view::npos ? host : host.substr(1, end - 1);
+  }
+
+  auto colon = host.rfind(':');
+  return colon == std::string_view::npos ? host : host.substr(0, colon);
+}
+
+bool EqualsIgnoreCase(std::string_view lhs, std::string_view rhs) {
+  return lhs.size() == rhs.size() &&
+         strncasecmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+// Patterns are lowercase.
+bool MatchHost(std::string_view pattern, std::string_view host) {
+  if (pattern.substr(0, 2) != "*.") {
+    return EqualsIgnoreCase(pattern, host);
+  }
+
+  auto domain = pattern.substr(2);
+  if (host.size() < domain.size()) {
+    return false;
+  }
+
+  auto suffix = host.substr(host.size() - domain.size());
+  return EqualsIgnoreCase(domain, suffix) &&
+         (host.size() == domain.size() ||
+          host[host.size() - domain.size() - 1] == '.');
+}
+
+}  // namespace
+
+const PriorityClass &ClassifyStream(std::string_view host, uint16_t port) {
+  const auto &cfg = AppConfig::GetInstance();
+  host = StripPort(host);
+  for (const auto &priority_class : cfg.priority_classes) {
+    const auto &ports = priority_class.ports;
+    if (std::find(ports.begin(), ports.end(), port) != ports.end()) {
+      return priority_class;
+    }
+
+    if (host.empty()) {
+      continue;
+    }
+
+    for (const auto &pattern : priority_class.hosts) {
+      if (MatchHost(pattern, host)) {
+        return priority_class;
+      }
+    }
+  }
+  return cfg.default_priority;
+}
+
+}  // namespace quic_tunnel
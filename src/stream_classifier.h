@@ -0,0 +1,23 @@
+#ifndef QUIC_TUNNEL_STREAM_CLASSIFIER_H_
+#define QUIC_TUNNEL_STREAM_CLASSIFIER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "app_config.h"
+
+namespace quic_tunnel {
+
+// Urgencies of quiche stream priorities in use, 0 to 7 as in RFC 9218.
+constexpr size_t kUrgencyLevels = 8;
+
+// Returns the first [[priority.classes]] entry matching the destination host
+// or TCP port of a stream, the default class otherwise. A host pattern is a
+// host name, or "*." followed by a domain to match the domain and all its
+// subdomains. Any port in host is ignored.
+const PriorityClass &ClassifyStream(std::string_view host, uint16_t port);
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_STREAM_CLASSIFIER_H_
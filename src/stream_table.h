@@ -0,0 +1,140 @@
+#ifndef QUIC_TUNNEL_STREAM_TABLE_H_
+#define QUIC_TUNNEL_STREAM_TABLE_H_
+
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "non_copyable.h"
+#include "quic/connection_callbacks.h"
+
+namespace quic_tunnel {
+
+// Stream values live in slab slots that are reused through a free list and
+// never move, so their addresses can be handed out as callback contexts.
+// Client-initiated bidirectional stream IDs are dense multiples of 4, so
+// they are indexed directly by stream_id / 4 within a window starting at the
+// oldest open stream. Any other ID falls back to a hash map.
+template <class T>
+class StreamTable : NonCopyable {
+ public:
+  StreamTable() : slots_(), free_slots_(), window_(), sparse_() {}
+
+  [[nodiscard]] size_t size() const noexcept { return size_; }
+  [[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+
+  T *Find(StreamId stream_id) {
+    auto slot = FindSlot(stream_id);
+    return slot == kNoSlot ? nullptr : &*slots_[slot];
+  }
+
+  template <class... Args>
+  T &Emplace(StreamId stream_id, Args &&...args) {
+    assert(FindSlot(stream_id) == kNoSlot);
+    uint32_t slot;
+    if (free_slots_.empty()) {
+      slot = slots_.size();
+      slots_.emplace_back();
+    } else {
+      slot = free_slots_.back();
+      free_slots_.pop_back();
+    }
+    auto &value = slots_[slot].emplace(std::forward<Args>(args)...);
+    ++size_;
+
+    const auto key = stream_id / kStreamIdStep;
+    if (window_.empty()) {
+      base_ = key;
+    }
+    if (stream_id % kStreamIdStep == 0 && key >= base_ &&
+        key - base_ < kMaxWindow) {
+      if (key - base_ >= window_.size()) {
+        window_.resize(key - base_ + 1, kNoSlot);
+      }
+      window_[key - base_] = slot;
+    } else {
+      sparse_.emplace(stream_id, slot);
+    }
+    return value;
+  }
+
+  void Erase(StreamId stream_id) {
+    uint32_t slot;
+    if (auto *indexed = WindowEntry(stream_id); indexed) {
+      slot = *indexed;
+      *indexed = kNoSlot;
+      while (!window_.empty() && window_.front() == kNoSlot) {
+        window_.pop_front();
+        ++base_;
+      }
+    } else if (auto iter = sparse_.find(stream_id); iter != sparse_.end()) {
+      slot = iter->second;
+      sparse_.erase(iter);
+    } else {
+      return;
+    }
+
+    slots_[slot].reset();
+    free_slots_.push_back(slot);
+    --size_;
+  }
+
+  // f may erase the value it is called with.
+  template <class F>
+  void ForEach(F &&f) {
+    for (auto &slot : slots_) {
+      if (slot) {
+        f(*slot);
+      }
+    }
+  }
+
+  template <class F>
+  void ForEach(F &&f) const {
+    for (const auto &slot : slots_) {
+      if (slot) {
+        f(*slot);
+      }
+    }
+  }
+
+ private:
+  uint32_t *WindowEntry(StreamId stream_id) {
+    const auto key = stream_id / kStreamIdStep;
+    if (stream_id % kStreamIdStep != 0 || key < base_ ||
+        key - base_ >= window_.size() || window_[key - base_] == kNoSlot) {
+      return nullptr;
+    }
+    return &window_[key - base_];
+  }
+
+  uint32_t FindSlot(StreamId stream_id) {
+    if (auto *indexed = WindowEntry(stream_id); indexed) {
+      return *indexed;
+    }
+    if (sparse_.empty()) {
+      return kNoSlot;
+    }
+    auto iter = sparse_.find(stream_id);
+    return iter == sparse_.end() ? kNoSlot : iter->second;
+  }
+
+  static inline constexpr StreamId kStreamIdStep = 4;
+  static inline constexpr uint64_t kMaxWindow = 64 * 1024;
+  static inline constexpr uint32_t kNoSlot = UINT32_MAX;
+
+  std::deque<std::optional<T>> slots_;
+  std::vector<uint32_t> free_slots_;
+  std::deque<uint32_t> window_;
+  uint64_t base_{};
+  std::unordered_map<StreamId, uint32_t> sparse_;
+  size_t size_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_STREAM_TABLE_H_
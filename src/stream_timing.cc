@@ -0,0 +1,212 @@
+#include "stream_timing.h"
+
+#include <spdlog/fmt/fmt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <unordered_map>
+
+#include "app_config.h"
+
+namespace quic_tunnel {
+namespace {
+
+constexpr const char *kStageNames[] = {
+    "accepted",           "first_request_byte",  "stream_opened",
+    "upstream_connected", "first_response_byte", "first_response_written",
+};
+
+static_assert(std::size(kStageNames) == StreamTiming::kStageCount);
+
+constexpr uint64_t kBoundsMicroseconds[] = {
+    100,    250,    500,     1000,    2500,    5000,    10000,   25000,
+    50000,  100000, 250000,  500000,  1000000, 2500000, 5000000, 10000000,
+};
+
+constexpr size_t kBucketCount = std::size(kBoundsMicroseconds);
+
+// Hosts beyond this many share one entry per thread.
+constexpr size_t kMaxHosts = 256;
+constexpr std::string_view kOtherHosts = "*";
+
+class StageHistogram {
+ public:
+  void Observe(uint64_t us) {
+    const auto *bound = std::lower_bound(
+        kBoundsMicroseconds, kBoundsMicroseconds + kBucketCount, us);
+    ++buckets_[bound - kBoundsMicroseconds];
+    ++count_;
+    sum_ += us;
+    max_ = std::max(max_, us);
+  }
+
+  void Stats(evbuffer *evb, std::string_view host, const char *stage) const {
+    if (count_ == 0) {
+      return;
+    }
+    evbuffer_add_printf(
+        evb,
+        "latency%s%.*s stage=%s count=%lu mean=%luus p50=%luus p90=%luus "
+        "p99=%luus max=%luus\n",
+        host.empty() ? "" : " host=", static_cast<int>(host.size()),
+        host.data(), stage, count_, sum_ / count_, Quantile(50), Quantile(90),
+        Quantile(99), max_);
+  }
+
+ private:
+  // The upper bound of the bucket holding the quantile.
+  [[nodiscard]] uint64_t Quantile(uint64_t percent) const {
+    const auto rank = (count_ * percent + 99) / 100;
+    uint64_t seen{};
+    for (size_t i = 0; i < kBucketCount; ++i) {
+      seen += buckets_[i];
+      if (seen >= rank) {
+        return std::min(kBoundsMicroseconds[i], max_);
+      }
+    }
+    return max_;
+  }
+
+  std::array<uint64_t, kBucketCount + 1> buckets_{};
+  uint64_t count_{};
+  uint64_t sum_{};
+  uint64_t max_{};
+};
+
+using StageHistograms = std::array<StageHistogram, StreamTiming::kStageCount>;
+
+using Times = std::array<uint64_t, StreamTiming::kStageCount>;
+
+struct ThreadTiming {
+  std::unordered_map<bufferevent *, Times> pending;
+  StageHistograms all;
+  std::unordered_map<std::string, StageHistograms> hosts;
+};
+
+ThreadTiming &GetThreadTiming() {
+  static thread_local ThreadTiming timing;
+  return timing;
+}
+
+bool IsEnabled() { return AppConfig::GetInstance().latency_breakdown; }
+
+}  // namespace
+
+uint64_t StreamTiming::Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void StreamTiming::Mark(bufferevent *bev, Stage stage) {
+  if (!IsEnabled()) {
+    return;
+  }
+
+  auto &time = GetThreadTiming().pending[bev][stage];
+  if (time == 0) {
+    time = Now();
+  }
+}
+
+void StreamTiming::Discard(bufferevent *bev) {
+  if (IsEnabled()) {
+    GetThreadTiming().pending.erase(bev);
+  }
+}
+
+void StreamTiming::Stats(evbuffer *evb) {
+  if (!IsEnabled()) {
+    return;
+  }
+
+  const auto &timing = GetThreadTiming();
+  for (size_t i = 0; i < kStageCount; ++i) {
+    timing.all[i].Stats(evb, {}, kStageNames[i]);
+  }
+  for (const auto &[host, histograms] : timing.hosts) {
+    for (size_t i = 0; i < kStageCount; ++i) {
+      histograms[i].Stats(evb, host, kStageNames[i]);
+    }
+  }
+}
+
+StreamTiming::StreamTiming() {
+  const auto &cfg = AppConfig::GetInstance();
+  if (cfg.latency_breakdown) {
+    times_ = std::make_unique<Times>();
+    server_ = cfg.is_server;
+  }
+}
+
+void StreamTiming::Adopt(bufferevent *bev) {
+  if (!times_) {
+    return;
+  }
+
+  auto &pending = GetThreadTiming().pending;
+  if (auto iter = pending.find(bev); iter != pending.end()) {
+    *times_ = iter->second;
+    pending.erase(iter);
+  }
+}
+
+void StreamTiming::Record(std::string_view host) const {
+  if (!times_) {
+    return;
+  }
+
+  auto &timing = GetThreadTiming();
+  StageHistograms *host_histograms{};
+  if (AppConfig::GetInstance().latency_per_host && !host.empty()) {
+    auto iter = timing.hosts.find(std::string(host));
+    if (iter == timing.hosts.end()) {
+      iter = timing.hosts
+                 .try_emplace(timing.hosts.size() < kMaxHosts
+                                  ? std::string(host)
+                                  : std::string(kOtherHosts))
+                 .first;
+    }
+    host_histograms = &iter->second;
+  }
+
+  const auto &times = *times_;
+  const auto first = std::find_if(times.begin(), times.end(),
+                                   [](auto time) { return time != 0; });
+  if (first == times.end()) {
+    return;
+  }
+  for (auto time = first + 1; time != times.end(); ++time) {
+    if (*time == 0) {
+      continue;
+    }
+    const auto us = (*time - std::min(*time, *first)) / 1000;
+    const auto stage = time - times.begin();
+    timing.all[stage].Observe(us);
+    if (host_histograms) {
+      (*host_histograms)[stage].Observe(us);
+    }
+  }
+}
+
+std::string StreamTiming::ToString() const {
+  if (!times_) {
+    return {};
+  }
+
+  const auto &times = *times_;
+  const auto first = std::find_if(times.begin(), times.end(),
+                                   [](auto time) { return time != 0; });
+  std::string result;
+  for (auto time = first; time != times.end(); ++time) {
+    if (*time != 0) {
+      fmt::format_to(std::back_inserter(result), ", {} +{}us",
+                     kStageNames[time - times.begin()],
+                     (*time - std::min(*time, *first)) / 1000);
+    }
+  }
+  return result;
+}
+
+}  // namespace quic_tunnel
@@ -0,0 +1,96 @@
+#ifndef QUIC_TUNNEL_STREAM_TIMING_H_
+#define QUIC_TUNNEL_STREAM_TIMING_H_
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "non_copyable.h"
+
+namespace quic_tunnel {
+
+// Timestamps of the stages of a stream, see latency_breakdown in the conf.
+// Each side sees its own stages: the client from kAccepted on, the server
+// from kStreamOpened on. When a stream closes, the time from its first stage
+// to each later one feeds per stage histograms of the thread, shown by
+// /stats. Disabled, a stream only holds a null pointer and every mark is a
+// test of it.
+class StreamTiming : NonCopyable {
+ public:
+  enum Stage {
+    kAccepted,
+    kFirstRequestByte,
+    kStreamOpened,
+    kUpstreamConnected,
+    kFirstResponseByte,
+    kFirstResponseWritten,
+    kStageCount,
+  };
+
+  // Stages of a client TCP connection before it gets a stream are kept by
+  // its bufferevent until Adopt or Discard.
+  static void Mark(bufferevent *bev, Stage stage);
+  static void Discard(bufferevent *bev);
+  static void Stats(evbuffer *evb);
+
+  StreamTiming();
+
+  void Adopt(bufferevent *bev);
+
+  void OnStreamOpened() { Mark(kStreamOpened); }
+  void OnUpstreamConnected() { Mark(kUpstreamConnected); }
+  // Request bytes are read from TCP on the client, response bytes on the
+  // server.
+  void OnTcpRead() {
+    if (times_) {
+      Mark(server_ ? kFirstResponseByte : kFirstRequestByte);
+    }
+  }
+  void OnStreamSent() {
+    if (times_ && server_) {
+      Mark(kFirstResponseWritten);
+    }
+  }
+  void OnStreamRead() {
+    if (times_ && !server_) {
+      Mark(kFirstResponseByte);
+    }
+  }
+  void OnTcpWritten() {
+    if (times_ && !server_) {
+      Mark(kFirstResponseWritten);
+    }
+  }
+  // Whether OnTcpWritten would still mark a stage.
+  [[nodiscard]] bool awaits_tcp_written() const noexcept {
+    return times_ && !server_ && (*times_)[kFirstResponseWritten] == 0;
+  }
+
+  // Feeds the histograms, once the stream is closed.
+  void Record(std::string_view host) const;
+  // Time of each stage since the first one, for the close-of-stream log.
+  [[nodiscard]] std::string ToString() const;
+
+ private:
+  using Times = std::array<uint64_t, kStageCount>;
+
+  void Mark(Stage stage) {
+    if (times_ && (*times_)[stage] == 0) {
+      (*times_)[stage] = Now();
+    }
+  }
+
+  static uint64_t Now();
+
+  std::unique_ptr<Times> times_;
+  bool server_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_STREAM_TIMING_H_
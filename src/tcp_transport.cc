@@ -0,0 +1,549 @@
+#include "tcp_transport.h"
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "app_config.h"
+#include "event/event.h"
+#include "log.h"
+#include "metrics.h"
+#include "ring_buffer.h"
+
+namespace quic_tunnel {
+namespace {
+
+// The first readv of the socket transport, doubled each time a read fills
+// it, up to tcp_read_watermark.
+constexpr size_t kInitialReadBytes = 16 * 1024;
+
+bool IsTransient(int error) {
+  return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+}
+
+void AddBufferedBytes(int64_t delta) {
+  Metrics::GetInstance().Add(Metrics::kBufferedBytes, delta);
+}
+
+void OnBufferChanged(evbuffer *, const evbuffer_cb_info *info, void *) {
+  AddBufferedBytes(static_cast<int64_t>(info->n_added) -
+                   static_cast<int64_t>(info->n_deleted));
+}
+
+class BuffereventTransport final : public TcpTransport {
+ public:
+  BuffereventTransport(bufferevent *bev, bool connected, bool eof,
+                       Callbacks &callbacks)
+      : bev_(bev), callbacks_(&callbacks), connected_(connected), closed_(eof) {
+    bufferevent_setcb(bev_, ReadCallback, nullptr, EventCallback, this);
+    // Counts the bytes buffered by bev in the metrics until freed.
+    for (auto *evb : {input(), output()}) {
+      AddBufferedBytes(evbuffer_get_length(evb));
+      evbuffer_add_cb(evb, OnBufferChanged, nullptr);
+    }
+  }
+
+  ~BuffereventTransport() override {
+    AddBufferedBytes(-static_cast<int64_t>(InputLength() + OutputLength()));
+    bufferevent_free(bev_);
+  }
+
+  int fd() const override { return bufferevent_getfd(bev_); }
+
+  int Peek(iovec *vecs, int n) override {
+    n = std::min(n, kMaxPeekChains);
+    evbuffer_iovec chains[kMaxPeekChains];
+    n = std::min(evbuffer_peek(input(), -1, nullptr, chains, n), n);
+    for (int i = 0; i < n; ++i) {
+      vecs[i] = {chains[i].iov_base, chains[i].iov_len};
+    }
+    return n;
+  }
+
+  size_t InputLength() const override {
+    return evbuffer_get_length(bufferevent_get_input(bev_));
+  }
+
+  void Drain(size_t len) override { evbuffer_drain(input(), len); }
+  // Reading again after EOF would only report it once more.
+  void EnableRead() override {
+    if (!closed_) {
+      bufferevent_enable(bev_, EV_READ);
+    }
+  }
+
+  void DisableRead() override { bufferevent_disable(bev_, EV_READ); }
+
+  ssize_t Write(const uint8_t *buf, size_t len) override {
+    auto *evb = output();
+    size_t written{};
+    if (connected_ && evbuffer_get_length(evb) == 0) {
+      written = WriteDirect(buf, len);
+    }
+
+    if (written < len && evbuffer_add(evb, buf + written, len - written) != 0) {
+      logger->error("failed to add event buffer");
+      return -1;
+    }
+    return written;
+  }
+
+  size_t OutputLength() const override {
+    return evbuffer_get_length(bufferevent_get_output(bev_));
+  }
+
+  void DiscardOutput() override { evbuffer_drain(output(), OutputLength()); }
+
+  void WatchOutput(size_t low_watermark) override {
+    bufferevent_setwatermark(bev_, EV_WRITE, low_watermark, 0);
+    bufferevent_setcb(bev_, ReadCallback, WriteCallback, EventCallback, this);
+  }
+
+  void UnwatchOutput() override {
+    bufferevent_setcb(bev_, ReadCallback, nullptr, EventCallback, this);
+  }
+
+  void Linger() override {
+    bufferevent_disable(bev_, EV_READ);
+    if (const auto len = InputLength(); len > 0) {
+      Drain(len);
+      LOG_RATE_LIMITED(spdlog::level::warn, 10, "discard TCP input {} bytes",
+                       len);
+    }
+
+    if (OutputLength() == 0) {
+      delete this;
+      return;
+    }
+    bufferevent_setwatermark(bev_, EV_WRITE, 0, 0);
+    bufferevent_setcb(bev_, nullptr, LingerWriteCallback, LingerEventCallback,
+                      this);
+  }
+
+ private:
+  static inline constexpr int kMaxPeekChains = 16;
+
+  static void ReadCallback(bufferevent *, void *ctx) {
+    auto *transport = static_cast<BuffereventTransport *>(ctx);
+    SPDLOG_LOGGER_TRACE(logger, "TCP read buffer {} bytes",
+                        transport->InputLength());
+    transport->callbacks_->OnTcpRead();
+  }
+
+  static void WriteCallback(bufferevent *, void *ctx) {
+    static_cast<BuffereventTransport *>(ctx)->callbacks_->OnTcpWrite();
+  }
+
+  static void EventCallback(bufferevent *, short what, void *ctx) {
+    if (what & BEV_EVENT_ERROR) {
+      logger->warn("buffer event socket error: {}", strerror(errno));
+    }
+
+    auto *transport = static_cast<BuffereventTransport *>(ctx);
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+      transport->closed_ = true;
+      transport->callbacks_->OnTcpClosed();
+    } else if (what & BEV_EVENT_CONNECTED) {
+      transport->connected_ = true;
+      transport->callbacks_->OnTcpConnected();
+    } else {
+      logger->warn("unknown events: {}", static_cast<int>(what));
+    }
+  }
+
+  static void LingerWriteCallback(bufferevent *, void *ctx) {
+    auto *transport = static_cast<BuffereventTransport *>(ctx);
+    if (transport->OutputLength() == 0) {
+      SPDLOG_LOGGER_DEBUG(logger, "TCP write finished");
+      delete transport;
+    }
+  }
+
+  static void LingerEventCallback(bufferevent *, short what, void *ctx) {
+    if (what & BEV_EVENT_ERROR) {
+      logger->warn("buffer event socket error: {}", strerror(errno));
+    }
+
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+      delete static_cast<BuffereventTransport *>(ctx);
+    }
+  }
+
+  evbuffer *input() { return bufferevent_get_input(bev_); }
+  evbuffer *output() { return bufferevent_get_output(bev_); }
+
+  // Writes to the socket right away when nothing is queued in the
+  // bufferevent, saving a copy into the evbuffer and a deferred write
+  // callback. Whatever the socket does not take is left to the bufferevent.
+  size_t WriteDirect(const uint8_t *buf, size_t len) {
+    if (!AppConfig::GetInstance().tcp_direct_write) {
+      return 0;
+    }
+
+    auto written = write(fd(), buf, len);
+    if (written < 0) {
+      if (!IsTransient(errno)) {
+        SPDLOG_LOGGER_DEBUG(logger, "direct TCP write failed: {}, fd: {}",
+                            strerror(errno), fd());
+      }
+      return 0;
+    }
+
+    SPDLOG_LOGGER_TRACE(logger, "TCP direct write {} of {} bytes", written,
+                        len);
+    return written;
+  }
+
+  bufferevent *const bev_;
+  Callbacks *const callbacks_;
+  bool connected_;
+  bool closed_;
+};
+
+class SocketTransport final : public TcpTransport {
+ public:
+  SocketTransport(bufferevent *bev, bool connected, bool eof,
+                  Callbacks &callbacks);
+  ~SocketTransport() override;
+
+  int fd() const override { return fd_; }
+
+  int Peek(iovec *vecs, int n) override {
+    iovec spans[2];
+    n = std::min(input_.ReadableSpans(spans, input_.size()), n);
+    std::copy_n(spans, n, vecs);
+    return n;
+  }
+
+  size_t InputLength() const override { return input_.size(); }
+
+  void Drain(size_t len) override {
+    input_.Consume(len);
+    AddBufferedBytes(-static_cast<int64_t>(len));
+  }
+
+  void EnableRead() override;
+  void DisableRead() override;
+  ssize_t Write(const uint8_t *buf, size_t len) override;
+  size_t OutputLength() const override { return output_.size(); }
+  void DiscardOutput() override;
+
+  void WatchOutput(size_t low_watermark) override {
+    low_watermark_ = low_watermark;
+    watching_ = true;
+  }
+
+  void UnwatchOutput() override { watching_ = false; }
+  void Linger() override;
+
+ private:
+  static std::unique_ptr<Event> NewEvent(event_base *base, int fd, short what,
+                                         event_callback_fn cb, void *arg);
+  static void Move(evbuffer *evb, RingBuffer &ring);
+
+  void OnReadable();
+  void OnWritable();
+  // Called once the connection failed or was closed by the peer.
+  void OnFailed();
+  int Flush();
+  void EnableWrite();
+  void DisableWrite();
+
+  const int fd_;
+  Callbacks *const callbacks_;
+  std::unique_ptr<Event> read_event_;
+  std::unique_ptr<Event> write_event_;
+  RingBuffer input_;
+  RingBuffer output_;
+  size_t read_bytes_{kInitialReadBytes};
+  size_t low_watermark_{};
+  bool connected_;
+  bool reading_{};
+  bool writing_{};
+  bool watching_{};
+  bool closed_{};
+  bool lingering_{};
+};
+
+// The socket is taken from bev, which is then freed without closing it.
+SocketTransport::SocketTransport(bufferevent *bev, bool connected, bool eof,
+                                 Callbacks &callbacks)
+    : fd_(bufferevent_getfd(bev)),
+      callbacks_(&callbacks),
+      read_event_(NewEvent(
+          bufferevent_get_base(bev), fd_, EV_READ | EV_PERSIST,
+          [](int, short, void *arg) {
+            static_cast<SocketTransport *>(arg)->OnReadable();
+          },
+          this)),
+      write_event_(NewEvent(
+          bufferevent_get_base(bev), fd_, EV_WRITE | EV_PERSIST,
+          [](int, short, void *arg) {
+            static_cast<SocketTransport *>(arg)->OnWritable();
+          },
+          this)),
+      input_(),
+      output_(),
+      connected_(connected),
+      closed_(eof) {
+  Move(bufferevent_get_input(bev), input_);
+  Move(bufferevent_get_output(bev), output_);
+  bufferevent_setfd(bev, -1);
+  bufferevent_free(bev);
+
+  EnableRead();
+  if (!connected_ || !output_.empty()) {
+    EnableWrite();
+  }
+}
+
+SocketTransport::~SocketTransport() {
+  AddBufferedBytes(-static_cast<int64_t>(input_.size() + output_.size()));
+  DisableRead();
+  DisableWrite();
+  if (close(fd_) != 0) {
+    logger->error("close fd {} failed: {}", fd_, strerror(errno));
+  }
+}
+
+std::unique_ptr<Event> SocketTransport::NewEvent(event_base *base, int fd,
+                                                 short what,
+                                                 event_callback_fn cb,
+                                                 void *arg) {
+  auto *ev = event_new(base, fd, what, cb, arg);
+  if (!ev) {
+    logger->error("failed to create event");
+    throw std::runtime_error("failed to create event");
+  }
+  return std::make_unique<Event>(ev);
+}
+
+void SocketTransport::Move(evbuffer *evb, RingBuffer &ring) {
+  const auto len = evbuffer_get_length(evb);
+  if (len == 0) {
+    return;
+  }
+
+  ring.Reserve(len);
+  iovec spans[2];
+  for (int i = 0; i < ring.WritableSpans(spans, len); ++i) {
+    evbuffer_remove(evb, spans[i].iov_base, spans[i].iov_len);
+  }
+  ring.Produce(len);
+  AddBufferedBytes(len);
+}
+
+void SocketTransport::EnableRead() {
+  if (!reading_ && !closed_ && !lingering_ && read_event_->Enable() == 0) {
+    reading_ = true;
+  }
+}
+
+void SocketTransport::DisableRead() {
+  if (reading_) {
+    read_event_->Disable();
+    reading_ = false;
+  }
+}
+
+void SocketTransport::EnableWrite() {
+  if (!writing_ && write_event_->Enable() == 0) {
+    writing_ = true;
+  }
+}
+
+void SocketTransport::DisableWrite() {
+  if (writing_) {
+    write_event_->Disable();
+    writing_ = false;
+  }
+}
+
+// Reads no more than the stream can send, so that the rest waits in the
+// socket, whose receive window then pushes back on the sender.
+void SocketTransport::OnReadable() {
+  const auto limit = callbacks_->TcpReadLimit();
+  if (limit == 0) {
+    DisableRead();
+    callbacks_->OnTcpReadBlocked();
+    return;
+  }
+
+  const size_t max_bytes = AppConfig::GetInstance().tcp_read_watermark;
+  auto n = std::min(read_bytes_,
+                    max_bytes - std::min(max_bytes, input_.size()));
+  if (limit > 0) {
+    n = std::min(n, static_cast<size_t>(limit));
+  }
+  if (n == 0) {
+    DisableRead();
+    return;
+  }
+
+  input_.Reserve(n);
+  iovec spans[2];
+  const auto r = readv(fd_, spans, input_.WritableSpans(spans, n));
+  if (r < 0 && IsTransient(errno)) {
+    return;
+  }
+
+  if (r <= 0) {
+    if (r < 0) {
+      logger->warn("TCP read failed: {}, fd: {}", strerror(errno), fd_);
+    }
+    OnFailed();
+    return;
+  }
+
+  input_.Produce(r);
+  AddBufferedBytes(r);
+  if (static_cast<size_t>(r) == n && n == read_bytes_) {
+    read_bytes_ = std::min(read_bytes_ * 2, max_bytes);
+  }
+  SPDLOG_LOGGER_TRACE(logger, "TCP read {} bytes, fd: {}", r, fd_);
+  callbacks_->OnTcpRead();
+}
+
+void SocketTransport::OnWritable() {
+  if (!connected_) {
+    int error{};
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len) != 0) {
+      error = errno;
+    }
+    if (error == EINPROGRESS) {
+      return;
+    }
+
+    if (error != 0) {
+      logger->warn("failed to connect: {}, fd: {}", strerror(error), fd_);
+      OnFailed();
+      return;
+    }
+
+    connected_ = true;
+    if (!lingering_) {
+      callbacks_->OnTcpConnected();
+    }
+  }
+
+  if (Flush() != 0) {
+    OnFailed();
+    return;
+  }
+
+  if (output_.empty()) {
+    DisableWrite();
+    if (lingering_) {
+      SPDLOG_LOGGER_DEBUG(logger, "TCP write finished");
+      delete this;
+      return;
+    }
+  }
+
+  if (watching_ && !lingering_ && output_.size() <= low_watermark_) {
+    callbacks_->OnTcpWrite();
+  }
+}
+
+void SocketTransport::OnFailed() {
+  if (lingering_) {
+    delete this;
+    return;
+  }
+
+  closed_ = true;
+  DisableRead();
+  DisableWrite();
+  callbacks_->OnTcpClosed();
+}
+
+// Returns -1 if the connection failed.
+int SocketTransport::Flush() {
+  while (!output_.empty()) {
+    iovec spans[2];
+    const auto size = output_.size();
+    const auto r = writev(fd_, spans, output_.ReadableSpans(spans, size));
+    if (r < 0) {
+      if (IsTransient(errno)) {
+        return 0;
+      }
+
+      SPDLOG_LOGGER_DEBUG(logger, "TCP write failed: {}, fd: {}",
+                          strerror(errno), fd_);
+      return -1;
+    }
+
+    output_.Consume(r);
+    AddBufferedBytes(-r);
+    SPDLOG_LOGGER_TRACE(logger, "TCP wrote {} of {} bytes, fd: {}", r, size,
+                        fd_);
+    if (static_cast<size_t>(r) < size) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+ssize_t SocketTransport::Write(const uint8_t *buf, size_t len) {
+  size_t written{};
+  if (connected_ && output_.empty()) {
+    const auto r = write(fd_, buf, len);
+    if (r > 0) {
+      written = r;
+    } else if (r < 0 && !IsTransient(errno)) {
+      // Left to the write event, which reports the failure.
+      SPDLOG_LOGGER_DEBUG(logger, "TCP write failed: {}, fd: {}",
+                          strerror(errno), fd_);
+    }
+  }
+
+  if (written < len) {
+    output_.Append(buf + written, len - written);
+    AddBufferedBytes(len - written);
+    EnableWrite();
+  }
+  return written;
+}
+
+void SocketTransport::DiscardOutput() {
+  AddBufferedBytes(-static_cast<int64_t>(output_.size()));
+  output_.Consume(output_.size());
+  if (connected_) {
+    DisableWrite();
+  }
+}
+
+void SocketTransport::Linger() {
+  lingering_ = true;
+  DisableRead();
+  if (const auto len = input_.size(); len > 0) {
+    Drain(len);
+    LOG_RATE_LIMITED(spdlog::level::warn, 10, "discard TCP input {} bytes",
+                     len);
+  }
+
+  if (output_.empty()) {
+    delete this;
+  }
+}
+
+}  // namespace
+
+std::unique_ptr<TcpTransport> TcpTransport::New(bufferevent *bev,
+                                                bool connected, bool eof,
+                                                Callbacks &callbacks) {
+  if (AppConfig::GetInstance().tcp_transport == "socket") {
+    return std::make_unique<SocketTransport>(bev, connected, eof, callbacks);
+  }
+  return std::make_unique<BuffereventTransport>(bev, connected, eof,
+                                                callbacks);
+}
+
+}  // namespace quic_tunnel
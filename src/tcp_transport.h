@@ -0,0 +1,77 @@
+#ifndef QUIC_TUNNEL_TCP_TRANSPORT_H_
+#define QUIC_TUNNEL_TCP_TRANSPORT_H_
+
+#include <event2/bufferevent.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "non_copyable.h"
+
+namespace quic_tunnel {
+
+// The TCP connection of a stream, see transport in [tcp] of the conf. The
+// bufferevent transport keeps the bytes in the evbuffers of the bufferevent
+// a connection was accepted or connected with. The socket transport takes
+// the socket over from it and reads and writes it with plain events, readv
+// into a ring of input bytes no larger than the stream can send, and writev
+// of what the socket did not take right away.
+class TcpTransport : NonCopyable {
+ public:
+  class Callbacks {
+   public:
+    virtual ~Callbacks() = default;
+
+    // Returns -1 if the stream was closed, and the transport freed with it.
+    virtual int OnTcpRead() = 0;
+    // The output fell to the watermark of WatchOutput.
+    virtual void OnTcpWrite() = 0;
+    virtual void OnTcpConnected() = 0;
+    virtual void OnTcpClosed() = 0;
+    // How many bytes the stream can take now, negative if unknown. The
+    // socket transport reads no more than that, and stops reading at 0 until
+    // EnableRead.
+    virtual ssize_t TcpReadLimit() = 0;
+    virtual void OnTcpReadBlocked() = 0;
+  };
+
+  // Takes over bev, connected or still connecting, with any bytes already
+  // read into it. eof tells that bev already reported the end of its input,
+  // which is then not read again.
+  static std::unique_ptr<TcpTransport> New(bufferevent *bev, bool connected,
+                                           bool eof, Callbacks &callbacks);
+
+  virtual ~TcpTransport() = default;
+
+  [[nodiscard]] virtual int fd() const = 0;
+
+  // Fills vecs with up to n spans of the input, oldest first, and returns
+  // the number of spans.
+  virtual int Peek(iovec *vecs, int n) = 0;
+  [[nodiscard]] virtual size_t InputLength() const = 0;
+  virtual void Drain(size_t len) = 0;
+  virtual void EnableRead() = 0;
+  virtual void DisableRead() = 0;
+
+  // Returns how many bytes went to the socket right away, the rest is
+  // buffered, or -1 on failure.
+  virtual ssize_t Write(const uint8_t *buf, size_t len) = 0;
+  [[nodiscard]] virtual size_t OutputLength() const = 0;
+  virtual void DiscardOutput() = 0;
+  // Calls OnTcpWrite once the output falls to low_watermark, until
+  // UnwatchOutput.
+  virtual void WatchOutput(size_t low_watermark) = 0;
+  virtual void UnwatchOutput() = 0;
+
+  // Hands the transport over to itself: the input is discarded, and the
+  // transport deletes itself once the output is written or the connection
+  // fails.
+  virtual void Linger() = 0;
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_TCP_TRANSPORT_H_
@@ -4,134 +4,71 @@
 #include <event2/bufferevent.h>
 #include <spdlog/fmt/bin_to_hex.h>
 
+#include <algorithm>
+#include <cstring>
 #include <tuple>
 #include <utility>
 
 #include "admin.h"
+#include "http_request_host_parser.h"
+#include "metrics.h"
+#include "record_log.h"
+#include "util.h"
 
 namespace quic_tunnel {
 namespace {
 
-class HttpRequestHostParser {
- public:
-  explicit HttpRequestHostParser(evbuffer *evb) : evb_(evb){};
-
-  const char *Parse() {
-    const auto max_search_length =
-        std::min(evbuffer_get_length(evb_), sizeof(line_) * 2);
-    evbuffer_ptr search_end;
-    evbuffer_ptr_set(evb_, &search_end, 0, EVBUFFER_PTR_SET);
-    evbuffer_ptr_set(evb_, &search_end, max_search_length, EVBUFFER_PTR_ADD);
-    first_eol_ = evbuffer_search_range(evb_, "\n", 1, nullptr, &search_end);
-    if (first_eol_.pos == -1) {
-      return "";
-    }
+constexpr size_t kSweepBudget = 64;
+// Spans of the TCP input sent to the stream per peek.
+constexpr int kMaxTcpReadSpans = 16;
 
-    const char *host = ParseFirstLine();
-    if (strlen(host) == 0) {
-      evbuffer_ptr_set(evb_, &first_eol_, 1, EVBUFFER_PTR_ADD);
-      second_eol_ =
-          evbuffer_search_range(evb_, "\n", 1, &first_eol_, &search_end);
-      if (second_eol_.pos != -1) {
-        host = ParseSecondLine();
-      }
-    }
-    return host;
+// Returns the host of the HTTP request at the start of evb, if any.
+std::string ParseHost(evbuffer *evb) {
+  if (AppConfig::GetInstance().protocol != "http") {
+    return {};
   }
+  return HttpRequestHostParser(evb).Parse();
+}
 
- private:
-  const char *ParseFirstLine() {
-    const char http[] = " HTTP/";
-    auto end = evbuffer_search_range(evb_, http, sizeof(http) - 1, nullptr,
-                                     &first_eol_);
-    if (end.pos == -1) {
-      return "";
-    }
-
-    auto begin = evbuffer_search_range(evb_, " ", 1, nullptr, &end);
-    if (begin.pos == -1) {
-      return "";
-    }
-
-    evbuffer_ptr_set(evb_, &begin, 1, EVBUFFER_PTR_ADD);
-    int len = end.pos - begin.pos;
-    if (len == 0 || len >= static_cast<int>(sizeof(line_) - 1)) {
-      return "";
-    }
-
-    len = evbuffer_copyout_from(evb_, &begin, line_, len);
-    if (len == -1) {
-      return "";
-    }
-
-    if (line_[0] == '/') {
-      return "";
-    }
-
-    line_[len] = '\0';
-    char *host = line_;
-    while (*host == ' ') {
-      ++host;
-    }
-
-    char *p = strstr(host, "://");
-    if (p) {
-      host = p + 3;
-    }
-
-    p = host;
-    while (*p && (*p != '/' && *p != ' ')) {
-      ++p;
-    }
-    *p = '\0';
-    return host;
+std::string ParseHost(const uint8_t *buf, size_t len) {
+  if (AppConfig::GetInstance().protocol != "http") {
+    return {};
   }
 
-  const char *ParseSecondLine() {
-    int len = second_eol_.pos - first_eol_.pos;
-    if (len == 0 || len >= static_cast<int>(sizeof(line_) - 1)) {
-      return "";
-    }
-
-    len = evbuffer_copyout_from(evb_, &first_eol_, line_, len);
-    if (len == -1) {
-      return "";
-    }
-
-    line_[len] = '\0';
-    char *host = line_;
-    while (*host && *host != ':') {
-      ++host;
-    }
-
-    if (*host != ':' || host - line_ < 4 ||
-        strncasecmp(host - 4, "host", 4) != 0) {
-      return "";
-    }
-
-    ++host;
-    while (*host == ' ') {
-      ++host;
-    }
-
-    char *p = host;
-    while (*p && (*p != ' ' && *p != '\r')) {
-      ++p;
-    }
-    *p = '\0';
-    return host;
+  UniquePtr<evbuffer, evbuffer_free> evb(evbuffer_new());
+  if (!evb || evbuffer_add_reference(evb.get(), buf, len, nullptr, nullptr)) {
+    return {};
   }
+  return HttpRequestHostParser(evb.get()).Parse();
+}
 
-  evbuffer *evb_;
-  evbuffer_ptr first_eol_;
-  evbuffer_ptr second_eol_;
-  char line_[80];
-};
+// The port the TCP connection of a stream is destined for: the listening
+// port on the client, the peer port on the server.
+uint16_t DestinationPort(int fd) {
+  const auto &cfg = AppConfig::GetInstance();
+  sockaddr_storage addr = cfg.peer_addr;
+  socklen_t len = sizeof(addr);
+  if (!cfg.is_server &&
+      getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+    return 0;
+  }
+  return ntohs(reinterpret_cast<const sockaddr_in *>(&addr)->sin_port);
+}
 
 }  // namespace
 
-TcpTunnelCallbacks::TcpTunnelCallbacks(Admin &admin) : admin_(admin) {
-  admin_.Register(*this);
+TcpTunnelCallbacks::TcpTunnelCallbacks(Admin &admin, EventBase &base)
+    : admin_(admin),
+      sweep_event_(base.NewEvent(
+          -1, 0,
+          [](int, short, void *arg) {
+            auto *callbacks = static_cast<TcpTunnelCallbacks *>(arg);
+            if (callbacks->IsEstablished()) {
+              callbacks->SweepBlockedStreams();
+            }
+          },
+          this)) {
+  admin_.Register(*this, base);
 }
 
 TcpTunnelCallbacks::~TcpTunnelCallbacks() {
@@ -150,17 +87,24 @@ void TcpTunnelCallbacks::Stats(evbuffer *evb) const {
   }
 
   connection_->Stats(evb);
-  evbuffer_add_printf(evb, "total streams %lu, peer streams left %lu\n",
-                      bev_to_stream_callbacks_.size(),
-                      connection_->PeerStreamsLeft());
-  for (const auto &[_, stream] : bev_to_stream_callbacks_) {
+  evbuffer_add_printf(
+      evb,
+      "total streams %lu, blocked streams %lu, peer streams left %lu, direct "
+      "write %luB\n",
+      streams_.size(), blocked_streams_, connection_->PeerStreamsLeft(),
+      direct_write_bytes_);
+  streams_.ForEach([evb](const StreamCallbacks &stream) {
+    const auto &priority = stream.priority();
     evbuffer_add_printf(evb,
-                        "  stream: %lu\n    host: %s\n    duration: %ds\n"
-                        "    recv: %luB\n    sent: %luB\n",
+                        "  stream: %lu\n    host: %s\n    priority: %s, "
+                        "urgency %u%s\n    duration: %ds\n    recv: %luB\n"
+                        "    sent: %luB\n",
                         stream.stream_id(), stream.host().c_str(),
+                        priority.name.c_str(), priority.urgency,
+                        priority.incremental ? ", incremental" : "",
                         stream.DurationSeconds(), stream.recv_bytes(),
                         stream.sent_bytes());
-  }
+  });
 }
 
 void TcpTunnelCallbacks::Close() {
@@ -171,19 +115,17 @@ void TcpTunnelCallbacks::Close() {
 }
 
 void TcpTunnelCallbacks::CloseStreams() {
-  if (!bev_to_stream_callbacks_.empty()) {
+  if (!streams_.empty()) {
     logger->info(
         "closing {} application connections since QUIC connection {:spn} "
         "closing/closed",
-        bev_to_stream_callbacks_.size(), HexId());
-    for (auto iter = bev_to_stream_callbacks_.cbegin();
-         iter != bev_to_stream_callbacks_.cend();) {
-      auto *bev = iter->first;
-      ++iter;
-      CloseOnTcpWriteFinished(bev);
-    }
+        streams_.size(), HexId());
+    closing_streams_ = true;
+    streams_.ForEach(
+        [this](StreamCallbacks &stream) { CloseOnTcpWriteFinished(stream); });
+    closing_streams_ = false;
   }
-  unwritable_streams_.clear();
+  assert(blocked_streams_ == 0);
 }
 
 void TcpTunnelCallbacks::OnConnected(Connection &connection) {
@@ -198,256 +140,435 @@ void TcpTunnelCallbacks::OnClosed() {
 
 void TcpTunnelCallbacks::OnStreamRead(StreamId stream_id, const uint8_t *buf,
                                       size_t len, bool finished) {
-  if (auto iter = stream_id_to_stream_callbacks_.find(stream_id);
-      iter == stream_id_to_stream_callbacks_.end()) {
-    if (finished && len == 0) {
-      logger->error("stream {} recv 0-byte fin frame, cid {:spn}", stream_id,
-                    HexId());
-      connection().Close(stream_id);
-      return;
+  if (auto *stream = streams_.Find(stream_id); stream) {
+    stream->OnStreamRead(buf, len, finished);
+    return;
+  }
+
+  if (finished && len == 0) {
+    logger->error("stream {} recv 0-byte fin frame, cid {:spn}", stream_id,
+                  HexId());
+    connection().Close(stream_id);
+    return;
+  }
+
+  auto *bev = OnNewStream();
+  if (!bev) {
+    connection().Close(stream_id);
+  } else {
+    NewStream(stream_id, bev, ParseHost(buf, len))
+        .OnStreamRead(buf, len, finished);
+  }
+}
+
+// Every stream blocked when packets arrive is checked once, at most
+// kSweepBudget of them per event loop iteration so that many blocked streams
+// do not stall the loop. More urgent streams are checked first, so they get
+// the connection's send capacity first.
+void TcpTunnelCallbacks::OnWritable() {
+  if (blocked_streams_ > 0) {
+    for (auto &list : blocked_) {
+      list.unchecked = list.size;
     }
+    SweepBlockedStreams();
+  }
+}
 
-    auto *bev = OnNewStream();
-    if (!bev) {
-      connection().Close(stream_id);
+void TcpTunnelCallbacks::SweepBlockedStreams() {
+  auto budget = kSweepBudget;
+  bool unchecked{};
+  for (auto &list : blocked_) {
+    while (list.unchecked > 0 && list.head && budget > 0) {
+      --list.unchecked;
+      --budget;
+      auto &stream = *list.head;
+      Unblock(stream);
+      if (connection().StreamCapacity(stream.stream_id()) == 0) {
+        Block(stream);
+      } else {
+        SPDLOG_LOGGER_TRACE(logger, "stream {} is writable, cid {:spn}",
+                            stream.stream_id(), HexId());
+        stream.OnStreamWrite();
+      }
+    }
+
+    if (list.unchecked > 0 && list.head) {
+      unchecked = true;
     } else {
-      NewStream(stream_id, bev).OnStreamRead(buf, len, finished);
+      list.unchecked = 0;
     }
-  } else {
-    iter->second.OnStreamRead(buf, len, finished);
+  }
+
+  if (unchecked) {
+    sweep_event_->Activate();
   }
 }
 
-void TcpTunnelCallbacks::OnStreamWrite(StreamId stream_id) {
-  if (const auto iter = unwritable_streams_.find(stream_id);
-      iter == unwritable_streams_.end()) {
+void TcpTunnelCallbacks::Block(StreamCallbacks &stream) {
+  if (stream.blocked_) {
     return;
-  } else {
-    unwritable_streams_.erase(iter);
   }
 
-  if (const auto iter = stream_id_to_stream_callbacks_.find(stream_id);
-      iter == stream_id_to_stream_callbacks_.end()) {
-    logger->warn("not found writable stream {}, cid {:spn}", stream_id,
-                 HexId());
+  auto &list = blocked_[stream.priority().urgency];
+  stream.blocked_ = true;
+  stream.blocked_prev_ = list.tail;
+  stream.blocked_next_ = nullptr;
+  if (list.tail) {
+    list.tail->blocked_next_ = &stream;
   } else {
-    iter->second.OnStreamWrite();
+    list.head = &stream;
   }
+  list.tail = &stream;
+  ++list.size;
+  ++blocked_streams_;
 }
 
-void TcpTunnelCallbacks::ReadCallback(bufferevent *bev, void *ctx) {
-  auto *evb = bufferevent_get_input(bev);
-  const auto length = evbuffer_get_length(evb);
-  logger->trace("TCP read buffer {} bytes", length);
-  if (length == 0) {
+void TcpTunnelCallbacks::Unblock(StreamCallbacks &stream) {
+  if (!stream.blocked_) {
     return;
   }
 
-  auto *callbacks = static_cast<TcpTunnelCallbacks *>(ctx);
-  if (const auto iter = callbacks->bev_to_stream_callbacks_.find(bev);
-      iter == callbacks->bev_to_stream_callbacks_.end()) {
-    if (callbacks->connection().PeerStreamsLeft() == 0) {
-      logger->warn("no peer streams left");
-      callbacks->Close(bev);
-    } else {
-      auto stream_id = callbacks->stream_id_generator_.Next();
-      callbacks->NewStream(stream_id, bev).OnTcpRead();
-    }
+  auto &list = blocked_[stream.priority().urgency];
+  if (stream.blocked_prev_) {
+    stream.blocked_prev_->blocked_next_ = stream.blocked_next_;
+  } else {
+    list.head = stream.blocked_next_;
+  }
+  if (stream.blocked_next_) {
+    stream.blocked_next_->blocked_prev_ = stream.blocked_prev_;
   } else {
-    iter->second.OnTcpRead();
+    list.tail = stream.blocked_prev_;
   }
+  stream.blocked_ = false;
+  stream.blocked_prev_ = nullptr;
+  stream.blocked_next_ = nullptr;
+  --list.size;
+  --blocked_streams_;
 }
 
-void TcpTunnelCallbacks::WriteCallback(bufferevent *bev, void *) {
-  auto *evb = bufferevent_get_output(bev);
-  if (evbuffer_get_length(evb) == 0) {
-    logger->debug("TCP write finished");
-    bufferevent_free(bev);
+// Moves a blocked stream to the list of its new urgency as well.
+void TcpTunnelCallbacks::Prioritize(StreamCallbacks &stream,
+                                    const PriorityClass &priority) {
+  const bool blocked = stream.blocked_;
+  Unblock(stream);
+  stream.priority_ = &priority;
+  if (blocked) {
+    Block(stream);
+  }
+
+  if (AppConfig::GetInstance().priority_enabled) {
+    connection().SetPriority(stream.stream_id(), priority.urgency,
+                             priority.incremental);
   }
 }
 
+void TcpTunnelCallbacks::ReadCallback(bufferevent *bev, void *ctx) {
+  static_cast<TcpTunnelCallbacks *>(ctx)->OnTcpRead(bev);
+}
+
+// Opens a stream for a TCP connection once it has data to send.
+TcpTunnelCallbacks::StreamCallbacks *TcpTunnelCallbacks::OnTcpRead(
+    bufferevent *bev, bool eof) {
+  const auto length = evbuffer_get_length(bufferevent_get_input(bev));
+  SPDLOG_LOGGER_TRACE(logger, "TCP read buffer {} bytes", length);
+  if (length == 0) {
+    return nullptr;
+  }
+
+  if (connection().PeerStreamsLeft() == 0) {
+    OnNoPeerStreamsLeft(bev);
+    return nullptr;
+  }
+
+  auto stream_id = stream_id_generator_.Next();
+  auto &stream =
+      NewStream(stream_id, bev, ParseHost(bufferevent_get_input(bev)), eof);
+  return stream.OnTcpRead() == 0 ? &stream : nullptr;
+}
+
+void TcpTunnelCallbacks::OnNoPeerStreamsLeft(bufferevent *bev) {
+  LOG_RATE_LIMITED(spdlog::level::warn, 10, "no peer streams left");
+  StreamTiming::Discard(bev);
+  bufferevent_free(bev);
+}
+
 void TcpTunnelCallbacks::EventCallback(bufferevent *bev, short what,
                                        void *ctx) {
   if (what & BEV_EVENT_ERROR) {
     logger->warn("buffer event socket error: {}", strerror(errno));
   }
 
-  auto *callbacks = static_cast<TcpTunnelCallbacks *>(ctx);
   if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
-    callbacks->CloseOnStreamWriteFinished(bev);
-  } else if (what & BEV_EVENT_CONNECTED) {
-    const auto iter = callbacks->bev_to_stream_callbacks_.find(bev);
-    logger->info("TCP connection established for stream {}, cid {:spn}",
-                 iter == callbacks->bev_to_stream_callbacks_.end()
-                     ? 0
-                     : iter->second.stream_id(),
-                 callbacks->HexId());
+    if (evbuffer_get_length(bufferevent_get_input(bev)) == 0) {
+      logger->info("TCP connection closed without sending data");
+      StreamTiming::Discard(bev);
+      bufferevent_free(bev);
+    } else if (auto *stream =
+                   static_cast<TcpTunnelCallbacks *>(ctx)->OnTcpRead(bev, true);
+               stream) {
+      stream->OnTcpClosed();
+    }
   } else {
     logger->warn("unknown events: {}", static_cast<int>(what));
   }
 }
 
 TcpTunnelCallbacks::StreamCallbacks &TcpTunnelCallbacks::NewStream(
-    StreamId stream_id, bufferevent *bev) {
-  assert(stream_id_to_stream_callbacks_.find(stream_id) ==
-         stream_id_to_stream_callbacks_.end());
-  assert(bev_to_stream_callbacks_.find(bev) == bev_to_stream_callbacks_.end());
-
-  auto pair = bev_to_stream_callbacks_.emplace(
-      std::piecewise_construct, std::forward_as_tuple(bev),
-      std::forward_as_tuple(*this, stream_id, bev));
-  stream_id_to_stream_callbacks_.emplace(stream_id, pair.first->second);
-  const auto &host = pair.first->second.host();
+    StreamId stream_id, bufferevent *bev, std::string host, bool eof) {
+  auto &stream = streams_.Emplace(stream_id, *this, stream_id, std::move(host));
+  stream.timing().Adopt(bev);
+  stream.timing().OnStreamOpened();
+  stream.transport_ = TcpTransport::New(
+      bev, !AppConfig::GetInstance().is_server, eof, stream);
+  auto &metrics = Metrics::GetInstance();
+  metrics.Increment(Metrics::kStreamsOpened);
+  metrics.Add(Metrics::kStreams, 1);
+  Prioritize(stream, ClassifyStream(stream.host(),
+                                   DestinationPort(stream.transport_->fd())));
   logger->info(
-      "new stream {}{}{}, total streams {}, peer streams left {}, cid {:spn}",
-      stream_id, host.empty() ? "" : " for ", host,
-      bev_to_stream_callbacks_.size(), connection().PeerStreamsLeft(), HexId());
-  return pair.first->second;
+      "new stream {}{}{}, priority {}, total streams {}, peer streams left {}, "
+      "cid {:spn}",
+      stream_id, stream.host().empty() ? "" : " for ", stream.host(),
+      stream.priority().name, streams_.size(), connection().PeerStreamsLeft(),
+      HexId());
+  return stream;
 }
 
-void TcpTunnelCallbacks::Close(bufferevent *bev, bool close_bev) {
-  if (close_bev) {
-    bufferevent_free(bev);
-  }
-
-  if (const auto iter = bev_to_stream_callbacks_.find(bev);
-      iter == bev_to_stream_callbacks_.end()) {
-    logger->info("TCP connection closed without sending data");
-  } else {
-    iter->second.Close();
-    auto stream_id = iter->second.stream_id();
-    if (const auto it = stream_id_to_stream_callbacks_.find(stream_id);
-        it == stream_id_to_stream_callbacks_.end()) {
-      logger->error("not found stream {}, cid {:spn}", stream_id, HexId());
-    } else {
-      stream_id_to_stream_callbacks_.erase(it);
-    }
-    bev_to_stream_callbacks_.erase(iter);
+void TcpTunnelCallbacks::Close(StreamCallbacks &stream) {
+  Unblock(stream);
+  stream.Close();
+  auto &metrics = Metrics::GetInstance();
+  metrics.Increment(Metrics::kStreamsClosed);
+  metrics.Add(Metrics::kStreams, -1);
+  metrics.Observe(Metrics::kStreamDuration, stream.DurationMilliseconds());
+  metrics.Observe(Metrics::kStreamBytes,
+                  stream.recv_bytes() + stream.sent_bytes());
+  stream.timing().Record(stream.host());
+  if (RecordLog::GetInstance().enabled()) {
+    WriteRecord(stream);
   }
+  streams_.Erase(stream.stream_id());
 }
 
-void TcpTunnelCallbacks::CloseOnTcpWriteFinished(bufferevent *bev) {
-  bool tcp_write_finished =
-      evbuffer_get_length(bufferevent_get_output(bev)) == 0;
-  Close(bev, tcp_write_finished);
-
-  if (!tcp_write_finished) {
-    bufferevent_disable(bev, EV_READ);
-    auto *evb = bufferevent_get_input(bev);
-    auto len = evbuffer_get_length(evb);
-    if (len > 0) {
-      evbuffer_drain(evb, len);
-      logger->warn("discard TCP input {} bytes", len);
-    }
-    bufferevent_setcb(bev, nullptr, WriteCallback, EventCallback, this);
-  }
+void TcpTunnelCallbacks::WriteRecord(const StreamCallbacks &stream) {
+  Record record{};
+  record.type = Record::kStream;
+  record.close_reason = stream.closed_     ? Record::kRemoteClosed
+                        : closing_streams_ ? Record::kConnectionClosed
+                                           : Record::kLocalClosed;
+  const auto &id = connection().id();
+  record.cid_len = id.size();
+  memcpy(record.cid, id.data(), id.size());
+  record.stream_id = stream.stream_id();
+  const auto duration = std::chrono::steady_clock::now() - stream.created_time_;
+  record.end_time = RecordLog::Now();
+  record.start_time =
+      record.end_time -
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  record.recv_bytes = stream.recv_bytes();
+  record.sent_bytes = stream.sent_bytes();
+  const auto stats = connection().stats();
+  record.rtt = stats.rtt;
+  record.cwnd = stats.cwnd;
+  record.lost = stats.lost;
+  record.delivery_rate = stats.delivery_rate;
+  const auto &host = stream.host();
+  record.host_len = std::min(host.size(), Record::kMaxHostBytes);
+  memcpy(record.host, host.data(), record.host_len);
+  RecordLog::GetInstance().Write(record);
 }
 
-void TcpTunnelCallbacks::CloseOnStreamWriteFinished(bufferevent *bev) {
-  ReadCallback(bev, this);
-  if (evbuffer_get_length(bufferevent_get_input(bev)) > 0) {
-    if (const auto iter = bev_to_stream_callbacks_.find(bev);
-        iter != bev_to_stream_callbacks_.end()) {
-      iter->second.set_tcp_closed();
-      auto *evb = bufferevent_get_output(bev);
-      auto len = evbuffer_get_length(evb);
-      if (len > 0) {
-        evbuffer_drain(evb, len);
-        logger->warn("discard TCP output {} bytes", len);
-      }
-    }
-  } else {
-    Close(bev);
+void TcpTunnelCallbacks::CloseOnTcpWriteFinished(StreamCallbacks &stream) {
+  if (stream.transport_->OutputLength() == 0) {
+    Close(stream);
+    return;
   }
+
+  auto *transport = stream.transport_.release();
+  Close(stream);
+  transport->Linger();
 }
 
 TcpTunnelCallbacks::StreamCallbacks::StreamCallbacks(
-    TcpTunnelCallbacks &callbacks, StreamId stream_id, bufferevent *bev)
+    TcpTunnelCallbacks &callbacks, StreamId stream_id, std::string host)
     : tcp_tunnel_callbacks_(callbacks),
       stream_id_(stream_id),
-      bev_(bev),
-      created_time_(std::chrono::steady_clock::now()) {
-  const auto &cfg = AppConfig::GetInstance();
-  if (!cfg.is_server && cfg.protocol == "http") {
-    auto *evb = bufferevent_get_input(bev_);
-    host_ = HttpRequestHostParser(evb).Parse();
-  }
-}
+      created_time_(std::chrono::steady_clock::now()),
+      host_(std::move(host)),
+      priority_(&AppConfig::GetInstance().default_priority),
+      timing_() {}
 
 void TcpTunnelCallbacks::StreamCallbacks::OnStreamRead(const uint8_t *buf,
                                                        size_t len,
                                                        bool finished) {
   if (len > 0) {
     recv_bytes_ += len;
+    timing_.OnStreamRead();
     if (tcp_closed_) {
       logger->error("TCP already closed, stream {} cid {:spn}", stream_id_,
                     tcp_tunnel_callbacks_.HexId());
     } else {
-      auto *evb = bufferevent_get_output(bev_);
-      // TODO if length > ... disable stream read
-      if (evbuffer_add(evb, buf, len) != 0) {
-        logger->error("failed to add event buffer");
-        tcp_tunnel_callbacks_.CloseOnTcpWriteFinished(bev_);
+      const auto written = transport_->Write(buf, len);
+      if (written < 0) {
+        logger->error("failed to buffer TCP output");
+        tcp_tunnel_callbacks_.CloseOnTcpWriteFinished(*this);
+        return;
+      }
+      tcp_tunnel_callbacks_.direct_write_bytes_ += written;
+      if (written > 0) {
+        timing_.OnTcpWritten();
+      }
+
+      const auto buffered = transport_->OutputLength();
+      SPDLOG_LOGGER_TRACE(logger, "TCP write buffer {} bytes", buffered);
+      const auto &cfg = AppConfig::GetInstance();
+      if (!finished && !read_paused_ &&
+          buffered >= cfg.tcp_write_high_watermark) {
+        read_paused_ = true;
+        transport_->WatchOutput(cfg.tcp_write_low_watermark);
+        tcp_tunnel_callbacks_.connection().PauseRead(stream_id_);
+      } else if (!read_paused_ && timing_.awaits_tcp_written()) {
+        // Nothing was written yet, the first write shrinks the output.
+        transport_->WatchOutput(buffered - 1);
       }
-      logger->trace("TCP write buffer {} bytes", evbuffer_get_length(evb));
     }
   }
 
   if (finished) {
     closed_ = true;
     LogStats(true);
-    tcp_tunnel_callbacks_.CloseOnTcpWriteFinished(bev_);
+    tcp_tunnel_callbacks_.CloseOnTcpWriteFinished(*this);
   }
 }
 
+void TcpTunnelCallbacks::StreamCallbacks::OnTcpConnected() {
+  timing_.OnUpstreamConnected();
+  logger->info("TCP connection established for stream {}, cid {:spn}",
+               stream_id_, tcp_tunnel_callbacks_.HexId());
+}
+
 void TcpTunnelCallbacks::StreamCallbacks::OnStreamWrite() {
-  bufferevent_enable(bev_, EV_READ);
-  OnTcpRead();
+  transport_->EnableRead();
+  if (OnTcpRead() != 0) {
+    return;
+  }
 
-  if (tcp_closed_ && evbuffer_get_length(bufferevent_get_input(bev_)) == 0) {
-    logger->debug("stream write finished");
-    tcp_tunnel_callbacks_.Close(bev_);
+  if (tcp_closed_ && transport_->InputLength() == 0) {
+    SPDLOG_LOGGER_DEBUG(logger, "stream write finished");
+    tcp_tunnel_callbacks_.Close(*this);
   }
 }
 
-void TcpTunnelCallbacks::StreamCallbacks::OnTcpRead() {
-  auto *evb = bufferevent_get_input(bev_);
-  const auto length = evbuffer_get_length(evb);
-  evbuffer_ptr ptr;
-  evbuffer_ptr_set(evb, &ptr, 0, EVBUFFER_PTR_SET);
-  evbuffer_iovec vec;
+void TcpTunnelCallbacks::StreamCallbacks::OnTcpWrite() {
+  // The output shrank, whichever watermark was watched.
+  timing_.OnTcpWritten();
+  if (!read_paused_) {
+    transport_->UnwatchOutput();
+    return;
+  }
+
+  const auto buffered = transport_->OutputLength();
+  if (buffered > AppConfig::GetInstance().tcp_write_low_watermark) {
+    return;
+  }
+
+  read_paused_ = false;
+  transport_->UnwatchOutput();
+  // May close this stream.
+  tcp_tunnel_callbacks_.connection().ResumeRead(stream_id_);
+}
+
+// Returns -1 if the stream was closed.
+int TcpTunnelCallbacks::StreamCallbacks::OnTcpRead() {
+  const auto length = transport_->InputLength();
+  if (length > 0) {
+    timing_.OnTcpRead();
+  }
+  iovec vecs[kMaxTcpReadSpans];
   size_t total_sent{};
-  while (evbuffer_peek(evb, -1, &ptr, &vec, 1) == 1) {
-    auto sent = tcp_tunnel_callbacks_.connection().Send(
-        stream_id_, static_cast<const uint8_t *>(vec.iov_base), vec.iov_len,
-        false);  // TODO do not flush every time
-    if (sent < 0) {
-      tcp_tunnel_callbacks_.CloseOnTcpWriteFinished(bev_);
-      break;
-    }
+  bool blocked = false;
+  while (!blocked) {
+    const auto n = transport_->Peek(vecs, kMaxTcpReadSpans);
+    size_t peeked_sent{};
+    for (int i = 0; i < n; ++i) {
+      auto sent = tcp_tunnel_callbacks_.connection().Send(
+          stream_id_, static_cast<const uint8_t *>(vecs[i].iov_base),
+          vecs[i].iov_len, false);
+      if (sent < 0) {
+        tcp_tunnel_callbacks_.CloseOnTcpWriteFinished(*this);
+        return -1;
+      }
 
-    total_sent += sent;
-    if (sent < static_cast<int>(vec.iov_len)) {
-      tcp_tunnel_callbacks_.unwritable_streams_.emplace(stream_id_);
-      bufferevent_disable(bev_, EV_READ);
-      logger->trace(
-          "stream {} send buffer is full, remaining {} bytes, total unwritable "
-          "streams {}",
-          stream_id_, length - total_sent,
-          tcp_tunnel_callbacks_.unwritable_streams_.size());
-      break;
+      peeked_sent += sent;
+      if (sent < static_cast<int>(vecs[i].iov_len)) {
+        blocked = true;
+        tcp_tunnel_callbacks_.Block(*this);
+        transport_->DisableRead();
+        SPDLOG_LOGGER_TRACE(
+            logger,
+            "stream {} send buffer is full, remaining {} bytes, total blocked "
+            "streams {}",
+            stream_id_, length - total_sent - peeked_sent,
+            tcp_tunnel_callbacks_.blocked_streams_);
+        break;
+      }
     }
 
-    if (evbuffer_ptr_set(evb, &ptr, vec.iov_len, EVBUFFER_PTR_ADD) != 0) {
-      logger->error("evbuffer_ptr_set failed");
+    transport_->Drain(peeked_sent);
+    total_sent += peeked_sent;
+    // Fewer spans than asked for were all of the input.
+    if (n < kMaxTcpReadSpans) {
       break;
     }
   }
 
-  evbuffer_drain(evb, total_sent);
   sent_bytes_ += total_sent;
-  logger->trace("TCP->QUIC {} bytes, remaining {} bytes", total_sent,
-                length - total_sent);
+  if (total_sent > 0) {
+    timing_.OnStreamSent();
+  }
+  if (priority_->bulk_bytes > 0 && sent_bytes_ >= priority_->bulk_bytes) {
+    SPDLOG_LOGGER_DEBUG(logger,
+                        "stream {} demoted to bulk after {} bytes, cid {:spn}",
+                        stream_id_, sent_bytes_, tcp_tunnel_callbacks_.HexId());
+    tcp_tunnel_callbacks_.Prioritize(*this,
+                                     AppConfig::GetInstance().bulk_priority);
+  }
+  SPDLOG_LOGGER_TRACE(logger, "TCP->QUIC {} bytes, remaining {} bytes",
+                      total_sent, length - total_sent);
+  return 0;
+}
+
+ssize_t TcpTunnelCallbacks::StreamCallbacks::TcpReadLimit() {
+  return tcp_tunnel_callbacks_.connection().StreamCapacity(stream_id_);
+}
+
+// The socket transport stopped reading as the stream is full, the sweep
+// enables it again once the stream is writable.
+void TcpTunnelCallbacks::StreamCallbacks::OnTcpReadBlocked() {
+  tcp_tunnel_callbacks_.Block(*this);
+  SPDLOG_LOGGER_TRACE(logger, "stream {} is full, TCP read blocked",
+                      stream_id_);
+}
+
+// Sends what is left of the TCP input before closing the stream. If the
+// stream cannot take all of it, the stream is closed once it becomes
+// writable and the input is drained.
+void TcpTunnelCallbacks::StreamCallbacks::OnTcpClosed() {
+  if (OnTcpRead() != 0) {
+    return;
+  }
+
+  if (transport_->InputLength() == 0) {
+    tcp_tunnel_callbacks_.Close(*this);
+    return;
+  }
+
+  tcp_closed_ = true;
+  tcp_tunnel_callbacks_.connection().ShutdownRead(stream_id_);
+  if (const auto len = transport_->OutputLength(); len > 0) {
+    transport_->DiscardOutput();
+    logger->warn("discard TCP output {} bytes", len);
+  }
 }
 
 void TcpTunnelCallbacks::StreamCallbacks::Close() {
@@ -467,12 +588,19 @@ int TcpTunnelCallbacks::StreamCallbacks::DurationSeconds() const noexcept {
   return seconds.count();
 }
 
+uint64_t TcpTunnelCallbacks::StreamCallbacks::DurationMilliseconds()
+    const noexcept {
+  auto duration = std::chrono::steady_clock::now() - created_time_;
+  return std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+      .count();
+}
+
 void TcpTunnelCallbacks::StreamCallbacks::LogStats(bool remote_closed) const {
   logger->info(
       "{}close stream {}{}{}, lasting {} seconds, recv {} bytes, sent {} "
-      "bytes, cid {:spn}",
+      "bytes{}, cid {:spn}",
       remote_closed ? "remote " : "", stream_id_, host_.empty() ? "" : " for ",
-      host_, DurationSeconds(), recv_bytes_, sent_bytes_,
+      host_, DurationSeconds(), recv_bytes_, sent_bytes_, timing_.ToString(),
       tcp_tunnel_callbacks_.HexId());
 }
 
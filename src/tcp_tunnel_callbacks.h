@@ -3,62 +3,89 @@
 
 #include <event2/bufferevent.h>
 
+#include <array>
 #include <chrono>
-#include <map>
-#include <set>
+#include <memory>
+#include <string>
 
 #include "non_copyable.h"
 #include "quic/connection.h"
+#include "stream_classifier.h"
 #include "stream_id_generator.h"
+#include "stream_table.h"
+#include "stream_timing.h"
+#include "tcp_transport.h"
+#include "tunnel_callbacks.h"
 
 namespace quic_tunnel {
 
 class Admin;
-class TcpTunnelCallbacks : public ConnectionCallbacks, NonCopyable {
+class TcpTunnelCallbacks : public TunnelCallbacks, NonCopyable {
  public:
   ~TcpTunnelCallbacks() override;
-  void Stats(evbuffer *) const;
-  void Close();
+  void Stats(evbuffer *) const override;
+  void Close() override;
+
+  [[nodiscard]] size_t stream_count() const noexcept {
+    return streams_.size();
+  }
 
  protected:
   static void ReadCallback(bufferevent *bev, void *ctx);
-  static void WriteCallback(bufferevent *bev, void *ctx);
   static void EventCallback(bufferevent *bev, short what, void *ctx);
 
-  explicit TcpTunnelCallbacks(Admin &admin);
+  TcpTunnelCallbacks(Admin &admin, EventBase &base);
   virtual bufferevent *OnNewStream() = 0;
+  virtual void OnNoPeerStreamsLeft(bufferevent *bev);
 
  private:
-  class StreamCallbacks : NonCopyable {
+  class StreamCallbacks : NonCopyable, public TcpTransport::Callbacks {
    public:
     StreamCallbacks(TcpTunnelCallbacks &callbacks, StreamId stream_id,
-                    bufferevent *bev);
+                    std::string host);
 
     void OnStreamRead(const uint8_t *buf, size_t len, bool finished);
     void OnStreamWrite();
-    void OnTcpRead();
+    int OnTcpRead() override;
+    void OnTcpWrite() override;
+    void OnTcpConnected() override;
+    void OnTcpClosed() override;
+    ssize_t TcpReadLimit() override;
+    void OnTcpReadBlocked() override;
     void Close();
 
     [[nodiscard]] auto stream_id() const noexcept { return stream_id_; }
     [[nodiscard]] int DurationSeconds() const noexcept;
+    [[nodiscard]] uint64_t DurationMilliseconds() const noexcept;
     [[nodiscard]] const auto &host() const noexcept { return host_; }
+    [[nodiscard]] const PriorityClass &priority() const noexcept {
+      return *priority_;
+    }
     [[nodiscard]] auto sent_bytes() const noexcept { return sent_bytes_; }
     [[nodiscard]] auto recv_bytes() const noexcept { return recv_bytes_; }
-    void set_tcp_closed() noexcept {
-      tcp_closed_ = true;
-      tcp_tunnel_callbacks_.connection().ShutdownRead(stream_id_);
-    }
+    StreamTiming &timing() noexcept { return timing_; }
 
    private:
+    friend class TcpTunnelCallbacks;
+
     void LogStats(bool remote_closed) const;
 
     TcpTunnelCallbacks &tcp_tunnel_callbacks_;
     const StreamId stream_id_;
-    bufferevent *const bev_;
+    // Set right after the stream is created, null once handed over to
+    // Linger.
+    std::unique_ptr<TcpTransport> transport_;
     const std::chrono::time_point<std::chrono::steady_clock> created_time_;
     std::string host_;
+    const PriorityClass *priority_;
+    StreamTiming timing_;
     size_t sent_bytes_{};
     size_t recv_bytes_{};
+    bool read_paused_{};
+    // Links of the blocked stream list.
+    StreamCallbacks *blocked_prev_{};
+    StreamCallbacks *blocked_next_{};
+    bool blocked_{};
     bool tcp_closed_{};
     bool closed_{};
   };
@@ -67,29 +94,47 @@ class TcpTunnelCallbacks : public ConnectionCallbacks, NonCopyable {
   [[nodiscard]] bool IsEstablished() const {
     return connection_ && connection_->IsEstablished();
   };
-  StreamCallbacks &NewStream(StreamId stream_id, bufferevent *bev);
+  // Streams blocked with the same urgency, oldest first. Only the first
+  // unchecked ones are checked by the current sweep.
+  struct BlockedList {
+    StreamCallbacks *head{};
+    StreamCallbacks *tail{};
+    size_t size{};
+    size_t unchecked{};
+  };
+
+  StreamCallbacks &NewStream(StreamId stream_id, bufferevent *bev,
+                             std::string host, bool eof = false);
+  StreamCallbacks *OnTcpRead(bufferevent *bev, bool eof = false);
   void OnConnected(Connection &) final;
   void OnClosed();
   void OnClosed(Connection &) final { OnClosed(); }
   void OnStreamRead(StreamId stream_id, const uint8_t *buf, size_t len,
                     bool finished) final;
-  void OnStreamWrite(StreamId) final;
-  [[nodiscard]] bool ReportWritableStreams() const final {
-    return !unwritable_streams_.empty();
-  }
+  void OnWritable() final;
+  void OnDatagramRead(const uint8_t *, size_t) final {}
+  void SweepBlockedStreams();
+  void Block(StreamCallbacks &stream);
+  void Unblock(StreamCallbacks &stream);
+  void Prioritize(StreamCallbacks &stream, const PriorityClass &priority);
   void CloseStreams();
 
   [[nodiscard]] auto HexId();
-  void Close(bufferevent *bev, bool close_bev = true);
-  void CloseOnTcpWriteFinished(bufferevent *);
-  void CloseOnStreamWriteFinished(bufferevent *bev);
+  void Close(StreamCallbacks &stream);
+  void WriteRecord(const StreamCallbacks &stream);
+  void CloseOnTcpWriteFinished(StreamCallbacks &stream);
 
   Admin &admin_;
   Connection *connection_{};
-  std::map<bufferevent *, StreamCallbacks> bev_to_stream_callbacks_;
-  std::map<StreamId, StreamCallbacks &> stream_id_to_stream_callbacks_;
-  std::set<StreamId> unwritable_streams_;
+  StreamTable<StreamCallbacks> streams_;
+  // Streams whose send buffer was full, by urgency.
+  std::array<BlockedList, kUrgencyLevels> blocked_;
+  size_t blocked_streams_{};
+  // Set while the streams are closed along with the connection.
+  bool closing_streams_{};
+  std::unique_ptr<Event> sweep_event_;
   StreamIdGenerator stream_id_generator_;
+  size_t direct_write_bytes_{};
 };
 
 }  // namespace quic_tunnel
@@ -2,13 +2,23 @@
 
 #include <event2/bufferevent.h>
 
+#include <algorithm>
+#include <functional>
+
 namespace quic_tunnel {
 namespace {
 
+// How often queued TCP connections retry while every QUIC connection of the
+// pool is out of peer streams.
+constexpr uint64_t kDrainIntervalMicroseconds = 50 * 1000;
+
 class ClientConnectionCallbacks : public TcpTunnelCallbacks {
  public:
-  explicit ClientConnectionCallbacks(Admin &admin)
-      : TcpTunnelCallbacks(admin){};
+  ClientConnectionCallbacks(
+      Admin &admin, EventBase &base,
+      std::function<void(bufferevent *)> on_no_peer_streams_left)
+      : TcpTunnelCallbacks(admin, base),
+        on_no_peer_streams_left_(std::move(on_no_peer_streams_left)){};
 
   void OnNewTcpConnection(bufferevent *bev) {
     bufferevent_setcb(bev, ReadCallback, nullptr, EventCallback, this);
@@ -17,13 +27,41 @@ class ClientConnectionCallbacks : public TcpTunnelCallbacks {
 
  private:
   bufferevent *OnNewStream() override { return nullptr; };
+  void OnNoPeerStreamsLeft(bufferevent *bev) override {
+    on_no_peer_streams_left_(bev);
+  }
+
+  std::function<void(bufferevent *)> on_no_peer_streams_left_;
 };
 
 }  // namespace
 
+TcpTunnelClient::TcpTunnelClient(const QuicConfig &quic_config,
+                                 EventBase &base, Admin &admin)
+    : quic_config_(quic_config),
+      base_(base),
+      admin_(admin),
+      listener_(),
+      pool_(),
+      waiting_bevs_(),
+      drain_timer_(base_.NewTimer(
+          [](int, short, void *arg) {
+            static_cast<TcpTunnelClient *>(arg)->DrainWaitingQueue();
+          },
+          this)) {}
+
+TcpTunnelClient::~TcpTunnelClient() {
+  closing_ = true;
+  pool_.clear();
+  FreeWaitingQueue();
+}
+
 int TcpTunnelClient::Bind(const AppConfig &cfg, EventBase &base) {
-  if (quic_client_.Connect() != 0) {
-    return -1;
+  for (uint32_t i = 0; i < cfg.connections; ++i) {
+    pool_.emplace_back(std::make_unique<PooledConnection>(*this, i));
+    if (pool_.back()->Connect() != 0) {
+      return -1;
+    }
   }
 
   listener_.reset(evconnlistener_new_bind(
@@ -42,14 +80,6 @@ int TcpTunnelClient::Bind(const AppConfig &cfg, EventBase &base) {
 void TcpTunnelClient::AcceptCallback(evconnlistener *listener,
                                      evutil_socket_t fd, sockaddr *, int,
                                      void *ctx) {
-  auto client = static_cast<TcpTunnelClient *>(ctx);
-  if (client->tcp_tunnel_callbacks_ &&
-      client->quic_client_.connection()->PeerStreamsLeft() == 0) {
-    logger->warn("no peer streams left");
-    evutil_closesocket(fd);
-    return;
-  }
-
   auto base = evconnlistener_get_base(listener);
   bufferevent *bev = bufferevent_socket_new(
       base, fd, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_DEFER_CALLBACKS);
@@ -66,28 +96,20 @@ void TcpTunnelClient::AcceptCallback(evconnlistener *listener,
     logger->error("failed to enable buffer event");
     bufferevent_free(bev);
     evutil_closesocket(fd);
+    return;
   }
+  StreamTiming::Mark(bev, StreamTiming::kAccepted);
 }
 
 void TcpTunnelClient::ReadCallback(bufferevent *bev, void *ctx) {
+  StreamTiming::Mark(bev, StreamTiming::kFirstRequestByte);
   auto *client = static_cast<TcpTunnelClient *>(ctx);
-  if (client->tcp_tunnel_callbacks_) {
-    dynamic_cast<ClientConnectionCallbacks *>(
-        client->tcp_tunnel_callbacks_.get())
-        ->OnNewTcpConnection(bev);
+  auto *pooled = client->waiting_bevs_.empty() ? client->SelectConnection()
+                                               : nullptr;
+  if (pooled) {
+    pooled->OnNewTcpConnection(bev);
   } else {
-    if (!client->quic_client_.connection() ||
-        client->quic_client_.connection()->IsClosed()) {
-      if (client->quic_client_.Connect() != 0) {
-        bufferevent_free(bev);
-        return;
-      }
-    }
-
-    client->waiting_bevs_.emplace(bev);
-    bufferevent_disable(bev, EV_READ);
-    logger->info("waiting for connected, waiting queue {}",
-                 client->waiting_bevs_.size());
+    client->Enqueue(bev);
   }
 }
 
@@ -97,30 +119,176 @@ void TcpTunnelClient::EventCallback(bufferevent *bev, short what, void *) {
   }
 
   if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+    StreamTiming::Discard(bev);
     bufferevent_free(bev);
   } else {
     logger->warn("invalid events: {}", static_cast<int>(what));
   }
 }
 
-void TcpTunnelClient::OnConnected(Connection &connection) {
-  auto callbacks = std::make_unique<ClientConnectionCallbacks>(admin_);
-  static_cast<ConnectionCallbacks *>(callbacks.get())->OnConnected(connection);
-  for (auto iter = waiting_bevs_.cbegin(); iter != waiting_bevs_.cend();) {
-    bufferevent_enable(*iter, EV_READ);
-    callbacks->OnNewTcpConnection(*iter);
-    iter = waiting_bevs_.erase(iter);
+TcpTunnelClient::PooledConnection *TcpTunnelClient::SelectConnection() {
+  PooledConnection *selected{};
+  for (auto &pooled : pool_) {
+    if (!pooled->IsAvailable()) {
+      continue;
+    }
+
+    if (!selected || pooled->stream_count() < selected->stream_count() ||
+        (pooled->stream_count() == selected->stream_count() &&
+         pooled->cwnd() > selected->cwnd())) {
+      selected = pooled.get();
+    }
+  }
+  return selected;
+}
+
+void TcpTunnelClient::Enqueue(bufferevent *bev) {
+  bufferevent_setcb(bev, ReadCallback, nullptr, EventCallback, this);
+  bufferevent_disable(bev, EV_READ);
+  waiting_bevs_.emplace_back(bev);
+  logger->info("waiting for QUIC connection, waiting queue {}",
+               waiting_bevs_.size());
+  EnsureCapacity();
+}
+
+void TcpTunnelClient::EnsureCapacity() {
+  if (std::any_of(pool_.cbegin(), pool_.cend(),
+                  [](const auto &pooled) { return pooled->IsConnecting(); })) {
+    return;
+  }
+
+  for (auto &pooled : pool_) {
+    if (pooled->IsClosed() && pooled->Connect() == 0) {
+      return;
+    }
+  }
+
+  const auto &cfg = AppConfig::GetInstance();
+  if (pool_.size() < cfg.max_connections) {
+    pool_.emplace_back(std::make_unique<PooledConnection>(*this, pool_.size()));
+    logger->info("all QUIC connections are busy, open connection {}",
+                 pool_.size() - 1);
+    if (pool_.back()->Connect() == 0) {
+      return;
+    }
   }
+
+  // Wait for the peer to raise the stream limit of some connection.
+  drain_timer_.Enable(kDrainIntervalMicroseconds);
+}
+
+void TcpTunnelClient::DrainWaitingQueue() {
+  while (!waiting_bevs_.empty()) {
+    auto *pooled = SelectConnection();
+    if (!pooled) {
+      EnsureCapacity();
+      return;
+    }
+
+    auto *bev = waiting_bevs_.front();
+    waiting_bevs_.pop_front();
+    bufferevent_enable(bev, EV_READ);
+    pooled->OnNewTcpConnection(bev);
+  }
+}
+
+void TcpTunnelClient::FreeWaitingQueue() {
+  for (auto *bev : waiting_bevs_) {
+    StreamTiming::Discard(bev);
+    bufferevent_free(bev);
+  }
+  waiting_bevs_.clear();
+}
+
+TcpTunnelClient::PooledConnection::PooledConnection(TcpTunnelClient &client,
+                                                    size_t index)
+    : client_(client),
+      index_(index),
+      quic_client_(client.quic_config_, client.base_, *this),
+      reconnect_timer_(client.base_.NewTimer(
+          [](int, short, void *arg) {
+            auto *pooled = static_cast<PooledConnection *>(arg);
+            if (!pooled->client_.closing_ && pooled->IsClosed()) {
+              logger->info("reconnect QUIC connection {}", pooled->index_);
+              pooled->Connect();
+            }
+          },
+          this)),
+      tcp_tunnel_callbacks_() {}
+
+bool TcpTunnelClient::PooledConnection::IsConnecting() {
+  return !tcp_tunnel_callbacks_ && !IsClosed();
+}
+
+bool TcpTunnelClient::PooledConnection::IsClosed() {
+  auto *connection = quic_client_.connection();
+  return !connection || connection->IsClosed();
+}
+
+bool TcpTunnelClient::PooledConnection::IsAvailable() {
+  return tcp_tunnel_callbacks_ && !IsClosed() &&
+         quic_client_.connection()->PeerStreamsLeft() > 0;
+}
+
+size_t TcpTunnelClient::PooledConnection::stream_count() const {
+  return tcp_tunnel_callbacks_ ? tcp_tunnel_callbacks_->stream_count() : 0;
+}
+
+size_t TcpTunnelClient::PooledConnection::cwnd() {
+  return quic_client_.connection()->stats().cwnd;
+}
+
+void TcpTunnelClient::PooledConnection::OnNewTcpConnection(bufferevent *bev) {
+  dynamic_cast<ClientConnectionCallbacks *>(tcp_tunnel_callbacks_.get())
+      ->OnNewTcpConnection(bev);
+}
+
+void TcpTunnelClient::PooledConnection::OnConnected(Connection &connection) {
+  auto callbacks = std::make_unique<ClientConnectionCallbacks>(
+      client_.admin_, client_.base_, [this](bufferevent *bev) {
+        logger->info("no peer streams left on QUIC connection {}", index_);
+        client_.Enqueue(bev);
+      });
+  static_cast<ConnectionCallbacks *>(callbacks.get())->OnConnected(connection);
   tcp_tunnel_callbacks_ = std::move(callbacks);
   connection.AddConnectionCallbacks(*tcp_tunnel_callbacks_);
+  client_.DrainWaitingQueue();
 }
 
-void TcpTunnelClient::OnClosed() {
-  tcp_tunnel_callbacks_.reset();
-  for (auto iter = waiting_bevs_.cbegin(); iter != waiting_bevs_.cend();) {
-    bufferevent_free(*iter);
-    iter = waiting_bevs_.erase(iter);
+void TcpTunnelClient::PooledConnection::OnClosed(Connection &) {
+  const bool connected = static_cast<bool>(tcp_tunnel_callbacks_);
+  OnClosed();
+  if (client_.closing_) {
+    return;
+  }
+
+  // Only a connection that was established is renewed, so an unreachable
+  // server is not retried in a loop.
+  const auto &cfg = AppConfig::GetInstance();
+  if (connected && cfg.reconnect_eagerly && index_ < cfg.connections) {
+    reconnect_timer_.Enable(0);
   }
+
+  if (client_.waiting_bevs_.empty()) {
+    return;
+  }
+
+  const bool usable = std::any_of(
+      client_.pool_.cbegin(), client_.pool_.cend(), [](const auto &pooled) {
+        return pooled->IsAvailable() || pooled->IsConnecting();
+      });
+  if (!connected && !usable) {
+    logger->warn("QUIC connection {} failed, drop {} waiting connections",
+                 index_, client_.waiting_bevs_.size());
+    client_.FreeWaitingQueue();
+  } else {
+    // The closing connection must not be replaced from its own callback.
+    client_.drain_timer_.Enable(0);
+  }
+}
+
+void TcpTunnelClient::PooledConnection::OnClosed() {
+  tcp_tunnel_callbacks_.reset();
 }
 
 }  // namespace quic_tunnel
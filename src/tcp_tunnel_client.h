@@ -3,6 +3,9 @@
 
 #include <event2/listener.h>
 
+#include <deque>
+#include <vector>
+
 #include "app_config.h"
 #include "quic/quic_client.h"
 #include "tcp_tunnel_callbacks.h"
@@ -10,32 +13,70 @@
 namespace quic_tunnel {
 
 class Admin;
-class TcpTunnelClient : NonCopyable, ConnectionCallbacks {
+
+// Spreads TCP connections over a pool of QUIC connections, each with its own
+// UDP source port and congestion window. New TCP connections go to the
+// connection with the fewest streams, and wait in a queue while every
+// connection is out of streams or still connecting.
+class TcpTunnelClient : NonCopyable {
  public:
-  TcpTunnelClient(const QuicConfig &quic_config, EventBase &base, Admin &admin)
-      : admin_(admin), quic_client_(quic_config, base, *this) {}
-  ~TcpTunnelClient() override { OnClosed(); }
+  TcpTunnelClient(const QuicConfig &quic_config, EventBase &base,
+                  Admin &admin);
+  ~TcpTunnelClient();
 
   int Bind(const AppConfig &, EventBase &);
 
  private:
+  class PooledConnection : NonCopyable, public ConnectionCallbacks {
+   public:
+    PooledConnection(TcpTunnelClient &client, size_t index);
+    ~PooledConnection() override { OnClosed(); }
+
+    int Connect() { return quic_client_.Connect(); }
+    [[nodiscard]] bool IsConnecting();
+    [[nodiscard]] bool IsClosed();
+    [[nodiscard]] bool IsAvailable();
+    [[nodiscard]] size_t stream_count() const;
+    [[nodiscard]] size_t cwnd();
+    void OnNewTcpConnection(bufferevent *bev);
+
+   private:
+    void OnClosed();
+
+    void OnConnected(Connection &) override;
+    void OnClosed(Connection &) override;
+    void OnStreamRead(StreamId, const uint8_t *, size_t, bool) override{};
+    void OnWritable() override {}
+    void OnDatagramRead(const uint8_t *, size_t) override {}
+
+    TcpTunnelClient &client_;
+    const size_t index_;
+    QuicClient quic_client_;
+    // Reconnects a closed connection of the base pool before any TCP
+    // connection has to wait for the handshake.
+    Timer reconnect_timer_;
+    std::unique_ptr<TcpTunnelCallbacks> tcp_tunnel_callbacks_;
+  };
+
   static void AcceptCallback(evconnlistener *listener, evutil_socket_t fd,
                              sockaddr *, int, void *);
   static void ReadCallback(bufferevent *bev, void *ctx);
   static void EventCallback(bufferevent *bev, short what, void *);
-  void OnClosed();
 
-  void OnConnected(Connection &) override;
-  void OnClosed(Connection &) override { OnClosed(); }
-  void OnStreamRead(StreamId, const uint8_t *, size_t, bool) override{};
-  void OnStreamWrite(StreamId) override {}
-  [[nodiscard]] bool ReportWritableStreams() const override { return false; }
+  PooledConnection *SelectConnection();
+  void Enqueue(bufferevent *bev);
+  void EnsureCapacity();
+  void DrainWaitingQueue();
+  void FreeWaitingQueue();
 
+  const QuicConfig &quic_config_;
+  EventBase &base_;
   Admin &admin_;
   UniquePtr<evconnlistener, evconnlistener_free> listener_;
-  QuicClient quic_client_;
-  std::set<bufferevent *> waiting_bevs_;
-  std::unique_ptr<TcpTunnelCallbacks> tcp_tunnel_callbacks_;
+  std::vector<std::unique_ptr<PooledConnection>> pool_;
+  std::deque<bufferevent *> waiting_bevs_;
+  Timer drain_timer_;
+  bool closing_{};
 };
 
 }  // namespace quic_tunnel
@@ -3,6 +3,7 @@
 #include <event2/bufferevent.h>
 
 #include "tcp_tunnel_callbacks.h"
+#include "udp_tunnel_callbacks.h"
 #include "util.h"
 
 namespace quic_tunnel {
@@ -12,7 +13,7 @@ namespace {
 class ServerConnectionCallbacks : public TcpTunnelCallbacks {
  public:
   ServerConnectionCallbacks(EventBase &base, Admin &admin)
-      : TcpTunnelCallbacks(admin), base_(base) {}
+      : TcpTunnelCallbacks(admin, base), base_(base) {}
 
  private:
   bufferevent *OnNewStream() override {
@@ -45,6 +46,9 @@ class ServerConnectionCallbacks : public TcpTunnelCallbacks {
 }  // namespace
 
 std::unique_ptr<ConnectionCallbacks> TcpTunnelServer::Create() {
+  if (AppConfig::GetInstance().protocol == "udp") {
+    return std::make_unique<UdpTunnelCallbacks>(admin_, base_, -1);
+  }
   return std::make_unique<ServerConnectionCallbacks>(base_, admin_);
 }
 
@@ -16,6 +16,8 @@ class TcpTunnelServer : NonCopyable, ConnectionCallbacksFactory {
 
   int Bind() { return quic_server_.Bind(); }
 
+  QuicServer &quic_server() noexcept { return quic_server_; }
+
   std::unique_ptr<ConnectionCallbacks> Create() override;
 
  private:
@@ -0,0 +1,19 @@
+#ifndef QUIC_TUNNEL_TUNNEL_CALLBACKS_H_
+#define QUIC_TUNNEL_TUNNEL_CALLBACKS_H_
+
+#include <event2/buffer.h>
+
+#include "quic/connection_callbacks.h"
+
+namespace quic_tunnel {
+
+// The callbacks of a QUIC connection carrying a tunnel, as seen by Admin.
+class TunnelCallbacks : public ConnectionCallbacks {
+ public:
+  virtual void Stats(evbuffer *) const = 0;
+  virtual void Close() = 0;
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_TUNNEL_CALLBACKS_H_
@@ -0,0 +1,445 @@
+#include "udp_tunnel_callbacks.h"
+
+#include <spdlog/fmt/bin_to_hex.h>
+#include <unistd.h>
+
+#include "admin.h"
+#include "app_config.h"
+#include "util.h"
+
+namespace quic_tunnel {
+namespace {
+
+// Datagrams read from a flow socket per event, so one busy flow does not
+// stall the loop.
+constexpr size_t kReadBudget = 64;
+// Reliable datagrams buffered while the stream is blocked, more are dropped.
+constexpr size_t kMaxReliableBytes = 1024 * 1024;
+constexpr size_t kMaxDatagramBytes = 65535;
+// Sent by the client to open the reliable stream, flow 0 carries nothing.
+constexpr uint8_t kOpenRecord[] = {0, 0};
+
+// QUIC variable-length integers, RFC 9000 section 16.
+size_t VarintSize(uint64_t value) {
+  return value < (1 << 6)    ? 1
+         : value < (1 << 14) ? 2
+         : value < (1 << 30) ? 4
+                             : 8;
+}
+
+void EncodeVarint(uint64_t value, size_t size, uint8_t *out) {
+  for (size_t i = size; i > 0; --i) {
+    out[i - 1] = value & 0xff;
+    value >>= 8;
+  }
+  out[0] |= (size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3) << 6;
+}
+
+// Returns the size of the varint at buf, 0 if buf is too short.
+size_t DecodeVarint(const uint8_t *buf, size_t len, uint64_t &value) {
+  if (len == 0) {
+    return 0;
+  }
+
+  const size_t size = 1 << (buf[0] >> 6);
+  if (len < size) {
+    return 0;
+  }
+
+  value = buf[0] & 0x3f;
+  for (size_t i = 1; i < size; ++i) {
+    value = value << 8 | buf[i];
+  }
+  return size;
+}
+
+uint64_t AddressKey(const sockaddr_storage &addr) {
+  const auto &in = reinterpret_cast<const sockaddr_in &>(addr);
+  return static_cast<uint64_t>(in.sin_addr.s_addr) << 16 | in.sin_port;
+}
+
+}  // namespace
+
+UdpTunnelCallbacks::UdpTunnelCallbacks(Admin &admin, EventBase &base,
+                                       int listen_fd)
+    : admin_(admin),
+      base_(base),
+      listen_fd_(listen_fd),
+      expire_timer_(base.NewTimer(
+          [](int, short, void *arg) {
+            static_cast<UdpTunnelCallbacks *>(arg)->ExpireFlows();
+          },
+          this)),
+      reliable_input_(evbuffer_new()),
+      reliable_output_(evbuffer_new()) {
+  admin_.Register(*this, base);
+}
+
+UdpTunnelCallbacks::~UdpTunnelCallbacks() {
+  admin_.Unregister(*this);
+  if (IsEstablished()) {
+    Close();
+    OnClosed();
+  }
+  CloseFlows();
+}
+
+auto UdpTunnelCallbacks::HexId() const {
+  return spdlog::to_hex(connection_->id());
+}
+
+void UdpTunnelCallbacks::Stats(evbuffer *evb) const {
+  if (!IsEstablished()) {
+    return;
+  }
+
+  connection_->Stats(evb);
+  evbuffer_add_printf(evb,
+                      "UDP flows %lu, datagrams sent %lu recv %lu, reliable "
+                      "sent %lu recv %lu, dropped %lu, max datagram %ldB\n",
+                      flows_.size(), datagrams_sent_, datagrams_recv_,
+                      reliable_sent_, reliable_recv_, dropped_,
+                      connection_->MaxDatagramSize());
+  const auto now = std::chrono::steady_clock::now();
+  for (const auto &[id, flow] : flows_) {
+    const auto idle = std::chrono::duration_cast<std::chrono::seconds>(
+        now - flow->last_active);
+    evbuffer_add_printf(evb,
+                        "  flow: %lu\n    addr: %s\n    idle: %lds\n"
+                        "    recv: %lu\n    sent: %lu\n",
+                        id, ToString(flow->addr), idle.count(), flow->recv,
+                        flow->sent);
+  }
+}
+
+void UdpTunnelCallbacks::Close() {
+  if (connection_) {
+    CloseFlows();
+    connection_->Close();
+  }
+}
+
+void UdpTunnelCallbacks::OnConnected(Connection &connection) {
+  connection_ = &connection;
+  const auto &cfg = AppConfig::GetInstance();
+  expire_timer_.Enable(cfg.udp_flow_idle_timeout * 1000 * 1000 / 2);
+  if (listen_fd_ >= 0 && cfg.udp_reliable_fallback) {
+    reliable_stream_ = stream_id_generator_.Next();
+    connection.Send(reliable_stream_, kOpenRecord, sizeof(kOpenRecord), false);
+  }
+}
+
+void UdpTunnelCallbacks::OnClosed() {
+  CloseFlows();
+  expire_timer_.Disable();
+  stream_id_generator_.Reset();
+  reliable_stream_ = 0;
+  evbuffer_drain(reliable_input_.get(),
+                 evbuffer_get_length(reliable_input_.get()));
+  evbuffer_drain(reliable_output_.get(),
+                 evbuffer_get_length(reliable_output_.get()));
+  connection_ = nullptr;
+}
+
+void UdpTunnelCallbacks::OnLocalDatagram(const sockaddr_storage &addr,
+                                         uint8_t *payload, size_t len) {
+  if (!IsEstablished()) {
+    ++dropped_;
+    return;
+  }
+
+  Flow *flow;
+  if (auto iter = flow_ids_.find(AddressKey(addr)); iter != flow_ids_.end()) {
+    flow = flows_[iter->second].get();
+  } else {
+    flow = NewFlow(++next_flow_id_, addr);
+  }
+
+  if (!flow) {
+    ++dropped_;
+    return;
+  }
+  SendToPeer(*flow, payload, len);
+}
+
+void UdpTunnelCallbacks::OnDatagramRead(const uint8_t *buf, size_t len) {
+  FlowId id;
+  auto size = DecodeVarint(buf, len, id);
+  if (size == 0 || id == 0) {
+    logger->warn("invalid datagram of {} bytes, cid {:spn}", len, HexId());
+    return;
+  }
+
+  ++datagrams_recv_;
+  OnPeerDatagram(id, buf + size, len - size);
+}
+
+// Datagrams on the reliable stream are records of a varint flow ID, a varint
+// length and the payload.
+void UdpTunnelCallbacks::OnStreamRead(StreamId stream_id, const uint8_t *buf,
+                                      size_t len, bool finished) {
+  if (reliable_stream_ == 0 && listen_fd_ < 0) {
+    reliable_stream_ = stream_id;
+    logger->info("reliable stream {} opened, cid {:spn}", stream_id, HexId());
+  }
+
+  if (stream_id != reliable_stream_) {
+    logger->warn("unexpected stream {}, cid {:spn}", stream_id, HexId());
+    connection_->Close(stream_id);
+    return;
+  }
+
+  auto *evb = reliable_input_.get();
+  evbuffer_add(evb, buf, len);
+  while (true) {
+    uint8_t header[16];
+    auto header_len = evbuffer_copyout(evb, header, sizeof(header));
+    FlowId id;
+    uint64_t payload_len;
+    auto id_size = DecodeVarint(header, header_len, id);
+    auto len_size = id_size == 0 ? 0
+                                 : DecodeVarint(header + id_size,
+                                                header_len - id_size,
+                                                payload_len);
+    if (len_size == 0) {
+      break;
+    }
+
+    if (payload_len > kMaxDatagramBytes) {
+      logger->error("invalid reliable datagram of {} bytes, cid {:spn}",
+                    payload_len, HexId());
+      evbuffer_drain(evb, evbuffer_get_length(evb));
+      connection_->Close(stream_id);
+      reliable_stream_ = 0;
+      return;
+    }
+
+    const auto record_len = id_size + len_size + payload_len;
+    if (evbuffer_get_length(evb) < record_len) {
+      break;
+    }
+
+    auto *record = evbuffer_pullup(evb, record_len);
+    if (id != 0) {
+      ++reliable_recv_;
+      OnPeerDatagram(id, record + id_size + len_size, payload_len);
+    }
+    evbuffer_drain(evb, record_len);
+  }
+
+  if (finished) {
+    logger->info("reliable stream {} closed, cid {:spn}", stream_id, HexId());
+    evbuffer_drain(evb, evbuffer_get_length(evb));
+    reliable_stream_ = 0;
+  }
+}
+
+void UdpTunnelCallbacks::OnPeerDatagram(FlowId id, const uint8_t *payload,
+                                        size_t len) {
+  Flow *flow{};
+  if (auto iter = flows_.find(id); iter != flows_.end()) {
+    flow = iter->second.get();
+  } else if (listen_fd_ < 0) {
+    flow = NewFlow(id, AppConfig::GetInstance().peer_addr);
+  }
+
+  if (!flow) {
+    ++dropped_;
+    SPDLOG_LOGGER_DEBUG(logger, "drop datagram of unknown flow {}, cid {:spn}",
+                        id, HexId());
+    return;
+  }
+
+  flow->last_active = std::chrono::steady_clock::now();
+  ++flow->recv;
+  auto r = listen_fd_ < 0
+               ? send(flow->fd, payload, len, 0)
+               : sendto(listen_fd_, payload, len, 0,
+                        reinterpret_cast<const sockaddr *>(&flow->addr),
+                        sizeof(flow->addr));
+  if (r < 0) {
+    ++dropped_;
+    SPDLOG_LOGGER_DEBUG(logger, "failed to send datagram of flow {}: {}", id,
+                        strerror(errno));
+  }
+}
+
+void UdpTunnelCallbacks::SendToPeer(Flow &flow, uint8_t *payload,
+                                    size_t len) {
+  flow.last_active = std::chrono::steady_clock::now();
+  ++flow.sent;
+  const auto header_len = VarintSize(flow.id);
+  auto *frame = payload - header_len;
+  EncodeVarint(flow.id, header_len, frame);
+  const auto max_len = connection_->MaxDatagramSize();
+  if (max_len >= 0 && header_len + len <= static_cast<size_t>(max_len)) {
+    auto r = connection_->SendDatagram(frame, header_len + len);
+    if (r >= 0) {
+      ++datagrams_sent_;
+      return;
+    }
+
+    if (r != QUICHE_ERR_BUFFER_TOO_SHORT) {
+      ++dropped_;
+      SPDLOG_LOGGER_DEBUG(logger,
+                          "datagram queue full, drop flow {}, cid {:spn}",
+                          flow.id, HexId());
+      return;
+    }
+  }
+
+  if (AppConfig::GetInstance().udp_reliable_fallback) {
+    SendReliable(flow.id, payload, len);
+  } else {
+    ++dropped_;
+    SPDLOG_LOGGER_DEBUG(
+        logger, "drop datagram of {} bytes of flow {}, max {}, cid {:spn}", len,
+        flow.id, max_len, HexId());
+  }
+}
+
+void UdpTunnelCallbacks::SendReliable(FlowId id, const uint8_t *payload,
+                                      size_t len) {
+  auto *evb = reliable_output_.get();
+  if (reliable_stream_ == 0 ||
+      evbuffer_get_length(evb) + len > kMaxReliableBytes) {
+    ++dropped_;
+    SPDLOG_LOGGER_DEBUG(
+        logger, "drop reliable datagram of {} bytes of flow {}, cid {:spn}",
+        len, id, HexId());
+    return;
+  }
+
+  uint8_t header[16];
+  const auto id_size = VarintSize(id);
+  const auto len_size = VarintSize(len);
+  EncodeVarint(id, id_size, header);
+  EncodeVarint(len, len_size, header + id_size);
+  evbuffer_add(evb, header, id_size + len_size);
+  evbuffer_add(evb, payload, len);
+  ++reliable_sent_;
+  FlushReliable();
+}
+
+void UdpTunnelCallbacks::FlushReliable() {
+  if (!IsEstablished() || reliable_stream_ == 0) {
+    return;
+  }
+
+  auto *evb = reliable_output_.get();
+  while (evbuffer_get_length(evb) > 0 &&
+         connection_->StreamCapacity(reliable_stream_) > 0) {
+    evbuffer_iovec vec;
+    evbuffer_peek(evb, -1, nullptr, &vec, 1);
+    auto sent = connection_->Send(reliable_stream_,
+                                  static_cast<const uint8_t *>(vec.iov_base),
+                                  vec.iov_len, false);
+    if (sent < 0) {
+      evbuffer_drain(evb, evbuffer_get_length(evb));
+      return;
+    }
+
+    evbuffer_drain(evb, sent);
+    if (static_cast<size_t>(sent) < vec.iov_len) {
+      return;
+    }
+  }
+}
+
+UdpTunnelCallbacks::Flow *UdpTunnelCallbacks::NewFlow(
+    FlowId id, const sockaddr_storage &addr) {
+  const auto &cfg = AppConfig::GetInstance();
+  if (flows_.size() >= cfg.udp_max_flows) {
+    logger->warn("too many UDP flows {}, cid {:spn}", flows_.size(), HexId());
+    return nullptr;
+  }
+
+  std::unique_ptr<Flow> flow(new Flow{*this, id, addr, -1, nullptr,
+                                      std::chrono::steady_clock::now(), 0, 0});
+  if (listen_fd_ < 0) {
+    flow->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (flow->fd == -1) {
+      logger->error("failed to create socket: {}", strerror(errno));
+      return nullptr;
+    }
+
+    if (evutil_make_socket_nonblocking(flow->fd) != 0 ||
+        connect(flow->fd, reinterpret_cast<const sockaddr *>(&addr),
+                sizeof(addr)) != 0) {
+      logger->error("failed to connect to {}: {}", ToString(addr),
+                    strerror(errno));
+      close(flow->fd);
+      return nullptr;
+    }
+
+    flow->event = base_.NewEvent(flow->fd, EV_READ | EV_PERSIST,
+                                 FlowReadCallback, flow.get());
+    if (flow->event->Enable() != 0) {
+      close(flow->fd);
+      return nullptr;
+    }
+  } else {
+    flow_ids_.emplace(AddressKey(addr), id);
+  }
+
+  logger->info("new UDP flow {} for {}, total flows {}, cid {:spn}", id,
+               ToString(addr), flows_.size() + 1, HexId());
+  return flows_.emplace(id, std::move(flow)).first->second.get();
+}
+
+void UdpTunnelCallbacks::CloseFlow(Flow &flow) {
+  logger->info("close UDP flow {}, recv {} sent {} datagrams", flow.id,
+               flow.recv, flow.sent);
+  if (flow.fd >= 0) {
+    flow.event.reset();
+    close(flow.fd);
+  } else {
+    flow_ids_.erase(AddressKey(flow.addr));
+  }
+  flows_.erase(flow.id);
+}
+
+void UdpTunnelCallbacks::CloseFlows() {
+  while (!flows_.empty()) {
+    CloseFlow(*flows_.begin()->second);
+  }
+}
+
+void UdpTunnelCallbacks::ExpireFlows() {
+  const auto &cfg = AppConfig::GetInstance();
+  const auto now = std::chrono::steady_clock::now();
+  const std::chrono::seconds timeout(cfg.udp_flow_idle_timeout);
+  for (auto iter = flows_.begin(); iter != flows_.end();) {
+    auto &flow = *iter->second;
+    ++iter;
+    if (now - flow.last_active >= timeout) {
+      CloseFlow(flow);
+    }
+  }
+
+  if (IsEstablished()) {
+    expire_timer_.Enable(cfg.udp_flow_idle_timeout * 1000 * 1000 / 2);
+  }
+}
+
+void UdpTunnelCallbacks::FlowReadCallback(int, short, void *arg) {
+  auto *flow = static_cast<Flow *>(arg);
+  flow->callbacks.OnFlowRead(*flow);
+}
+
+void UdpTunnelCallbacks::OnFlowRead(Flow &flow) {
+  for (size_t i = 0; i < kReadBudget && IsEstablished(); ++i) {
+    auto len = recv(flow.fd, udp_buffer + kHeadroom,
+                    sizeof(udp_buffer) - kHeadroom, 0);
+    if (len < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        SPDLOG_LOGGER_DEBUG(logger, "failed to recv from UDP flow {}: {}",
+                            flow.id, strerror(errno));
+      }
+      return;
+    }
+    SendToPeer(flow, udp_buffer + kHeadroom, len);
+  }
+}
+
+}  // namespace quic_tunnel
@@ -0,0 +1,106 @@
+#ifndef QUIC_TUNNEL_UDP_TUNNEL_CALLBACKS_H_
+#define QUIC_TUNNEL_UDP_TUNNEL_CALLBACKS_H_
+
+#include <event2/buffer.h>
+
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+
+#include "non_copyable.h"
+#include "quic/connection.h"
+#include "stream_id_generator.h"
+#include "tunnel_callbacks.h"
+
+namespace quic_tunnel {
+
+class Admin;
+
+// Carries the UDP datagrams of many flows over one QUIC connection. A flow is
+// an application address on the client, and a UDP socket connected to
+// peer_addr on the server, which is opened on the first datagram of the flow.
+// Flows are closed on both sides after flow_idle_timeout.
+//
+// Each datagram is sent in a QUIC DATAGRAM frame, prefixed with the varint
+// flow ID. Datagrams larger than a frame can carry are dropped, or sent over
+// a single stream opened by the client, prefixed with the varint flow ID and
+// length, if reliable_fallback is set.
+class UdpTunnelCallbacks : public TunnelCallbacks, NonCopyable {
+ public:
+  using FlowId = uint64_t;
+
+  // Payloads passed to OnLocalDatagram have this many bytes free before them,
+  // so the flow ID is prepended without a copy.
+  static constexpr size_t kHeadroom = 8;
+
+  // listen_fd is the client's UDP socket, replies to applications are sent
+  // from it. It is -1 on the server.
+  UdpTunnelCallbacks(Admin &admin, EventBase &base, int listen_fd);
+  ~UdpTunnelCallbacks() override;
+
+  void Stats(evbuffer *) const override;
+  void Close() override;
+
+  // A datagram an application on the client sent to addr.
+  void OnLocalDatagram(const sockaddr_storage &addr, uint8_t *payload,
+                       size_t len);
+
+ private:
+  struct Flow {
+    UdpTunnelCallbacks &callbacks;
+    const FlowId id;
+    sockaddr_storage addr;
+    int fd;
+    std::unique_ptr<Event> event;
+    std::chrono::steady_clock::time_point last_active;
+    size_t sent;
+    size_t recv;
+  };
+
+  static void FlowReadCallback(int fd, short, void *arg);
+
+  [[nodiscard]] bool IsEstablished() const {
+    return connection_ && connection_->IsEstablished();
+  }
+  void OnConnected(Connection &) final;
+  void OnClosed(Connection &) final { OnClosed(); }
+  void OnClosed();
+  void OnStreamRead(StreamId stream_id, const uint8_t *buf, size_t len,
+                    bool finished) final;
+  void OnWritable() final { FlushReliable(); }
+  void OnDatagramRead(const uint8_t *buf, size_t len) final;
+
+  Flow *NewFlow(FlowId id, const sockaddr_storage &addr);
+  void CloseFlow(Flow &flow);
+  void CloseFlows();
+  void ExpireFlows();
+  void OnFlowRead(Flow &flow);
+  void SendToPeer(Flow &flow, uint8_t *payload, size_t len);
+  void SendReliable(FlowId id, const uint8_t *payload, size_t len);
+  void FlushReliable();
+  void OnPeerDatagram(FlowId id, const uint8_t *payload, size_t len);
+  [[nodiscard]] auto HexId() const;
+
+  Admin &admin_;
+  EventBase &base_;
+  const int listen_fd_;
+  Connection *connection_{};
+  std::unordered_map<FlowId, std::unique_ptr<Flow>> flows_;
+  // Flows of the client by application address.
+  std::unordered_map<uint64_t, FlowId> flow_ids_;
+  FlowId next_flow_id_{};
+  Timer expire_timer_;
+  StreamIdGenerator stream_id_generator_;
+  StreamId reliable_stream_{};
+  UniquePtr<evbuffer, evbuffer_free> reliable_input_;
+  UniquePtr<evbuffer, evbuffer_free> reliable_output_;
+  size_t datagrams_sent_{};
+  size_t datagrams_recv_{};
+  size_t reliable_sent_{};
+  size_t reliable_recv_{};
+  size_t dropped_{};
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_UDP_TUNNEL_CALLBACKS_H_
@@ -0,0 +1,144 @@
+#include "udp_tunnel_client.h"
+
+#include <unistd.h>
+
+#include "util.h"
+
+namespace quic_tunnel {
+namespace {
+
+// Datagrams read per event, so the listener does not stall the loop.
+constexpr size_t kReadBudget = 64;
+constexpr size_t kMaxWaitingDatagrams = 256;
+
+}  // namespace
+
+UdpTunnelClient::UdpTunnelClient(const QuicConfig &quic_config,
+                                 EventBase &base, Admin &admin)
+    : base_(base),
+      admin_(admin),
+      reconnect_timer_(base.NewTimer(
+          [](int, short, void *arg) {
+            auto *client = static_cast<UdpTunnelClient *>(arg);
+            if (client->IsClosed()) {
+              logger->info("reconnect QUIC connection");
+              client->quic_client_.Connect();
+            }
+          },
+          this)),
+      quic_client_(quic_config, base, *this) {}
+
+UdpTunnelClient::~UdpTunnelClient() {
+  closing_ = true;
+  event_.reset();
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+int UdpTunnelClient::Bind(const AppConfig &cfg, EventBase &base) {
+  if (quic_client_.Connect() != 0) {
+    return -1;
+  }
+
+  fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd_ == -1) {
+    logger->error("failed to create socket: {}", strerror(errno));
+    return -1;
+  }
+
+  if (evutil_make_socket_nonblocking(fd_) != 0 ||
+      bind(fd_, reinterpret_cast<const sockaddr *>(&cfg.bind_addr),
+           sizeof(cfg.bind_addr)) != 0) {
+    logger->error("failed to bind to {}, {}", ToString(cfg.bind_addr),
+                  strerror(errno));
+    return -1;
+  }
+
+  event_ = base.NewEvent(fd_, EV_READ | EV_PERSIST, ReadCallback, this);
+  if (event_->Enable() != 0) {
+    return -1;
+  }
+
+  logger->info("UDP listening on {}, fd: {}", ToString(cfg.bind_addr), fd_);
+  return 0;
+}
+
+void UdpTunnelClient::ReadCallback(int fd, short, void *arg) {
+  auto *client = static_cast<UdpTunnelClient *>(arg);
+  auto *payload = udp_buffer + UdpTunnelCallbacks::kHeadroom;
+  for (size_t i = 0; i < kReadBudget; ++i) {
+    sockaddr_storage addr{};
+    socklen_t addr_len = sizeof(addr);
+    auto len = recvfrom(fd, payload,
+                        sizeof(udp_buffer) - UdpTunnelCallbacks::kHeadroom, 0,
+                        reinterpret_cast<sockaddr *>(&addr), &addr_len);
+    if (len < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        logger->warn("failed to recv: {}", strerror(errno));
+      }
+      return;
+    }
+    client->OnDatagram(addr, payload, len);
+  }
+}
+
+bool UdpTunnelClient::IsClosed() {
+  auto *connection = quic_client_.connection();
+  return !connection || connection->IsClosed();
+}
+
+void UdpTunnelClient::OnDatagram(const sockaddr_storage &addr,
+                                 uint8_t *payload, size_t len) {
+  if (udp_tunnel_callbacks_) {
+    udp_tunnel_callbacks_->OnLocalDatagram(addr, payload, len);
+    return;
+  }
+
+  if (IsClosed() && quic_client_.Connect() != 0) {
+    return;
+  }
+
+  if (waiting_datagrams_.size() >= kMaxWaitingDatagrams) {
+    logger->warn("waiting queue full, drop datagram of {} bytes", len);
+    return;
+  }
+
+  auto &datagram = waiting_datagrams_.emplace_back();
+  datagram.addr = addr;
+  datagram.buf.resize(UdpTunnelCallbacks::kHeadroom + len);
+  memcpy(datagram.buf.data() + UdpTunnelCallbacks::kHeadroom, payload, len);
+}
+
+void UdpTunnelClient::OnConnected(Connection &connection) {
+  auto callbacks = std::make_unique<UdpTunnelCallbacks>(admin_, base_, fd_);
+  static_cast<ConnectionCallbacks *>(callbacks.get())->OnConnected(connection);
+  udp_tunnel_callbacks_ = std::move(callbacks);
+  connection.AddConnectionCallbacks(*udp_tunnel_callbacks_);
+  for (auto &datagram : waiting_datagrams_) {
+    udp_tunnel_callbacks_->OnLocalDatagram(
+        datagram.addr, datagram.buf.data() + UdpTunnelCallbacks::kHeadroom,
+        datagram.buf.size() - UdpTunnelCallbacks::kHeadroom);
+  }
+  waiting_datagrams_.clear();
+}
+
+void UdpTunnelClient::OnClosed(Connection &) {
+  const bool connected = static_cast<bool>(udp_tunnel_callbacks_);
+  udp_tunnel_callbacks_.reset();
+  if (closing_) {
+    return;
+  }
+
+  if (!connected) {
+    if (!waiting_datagrams_.empty()) {
+      logger->warn("QUIC connection failed, drop {} waiting datagrams",
+                   waiting_datagrams_.size());
+      waiting_datagrams_.clear();
+    }
+  } else if (AppConfig::GetInstance().reconnect_eagerly) {
+    reconnect_timer_.Enable(0);
+  }
+}
+
+}  // namespace quic_tunnel
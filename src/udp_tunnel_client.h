@@ -0,0 +1,59 @@
+#ifndef QUIC_TUNNEL_UDP_TUNNEL_CLIENT_H_
+#define QUIC_TUNNEL_UDP_TUNNEL_CLIENT_H_
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "app_config.h"
+#include "quic/quic_client.h"
+#include "udp_tunnel_callbacks.h"
+
+namespace quic_tunnel {
+
+class Admin;
+
+// Receives UDP datagrams on bind_addr and tunnels them over one QUIC
+// connection, which is reconnected when a datagram arrives after it closed.
+// Datagrams wait in a bounded queue during the handshake.
+class UdpTunnelClient : NonCopyable, public ConnectionCallbacks {
+ public:
+  UdpTunnelClient(const QuicConfig &quic_config, EventBase &base,
+                  Admin &admin);
+  ~UdpTunnelClient() override;
+
+  int Bind(const AppConfig &, EventBase &);
+
+ private:
+  struct WaitingDatagram {
+    sockaddr_storage addr;
+    // The payload follows UdpTunnelCallbacks::kHeadroom free bytes.
+    std::vector<uint8_t> buf;
+  };
+
+  static void ReadCallback(int fd, short, void *arg);
+
+  [[nodiscard]] bool IsClosed();
+  void OnDatagram(const sockaddr_storage &addr, uint8_t *payload, size_t len);
+
+  void OnConnected(Connection &) override;
+  void OnClosed(Connection &) override;
+  void OnStreamRead(StreamId, const uint8_t *, size_t, bool) override {}
+  void OnWritable() override {}
+  void OnDatagramRead(const uint8_t *, size_t) override {}
+
+  EventBase &base_;
+  Admin &admin_;
+  int fd_{-1};
+  std::unique_ptr<Event> event_;
+  Timer reconnect_timer_;
+  std::unique_ptr<UdpTunnelCallbacks> udp_tunnel_callbacks_;
+  std::deque<WaitingDatagram> waiting_datagrams_;
+  bool closing_{};
+  // Destroyed first, its connection closes the callbacks above.
+  QuicClient quic_client_;
+};
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_UDP_TUNNEL_CLIENT_H_
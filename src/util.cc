@@ -7,11 +7,11 @@
 
 namespace quic_tunnel {
 
-uint8_t udp_buffer[65535];
-uint8_t quic_buffer[65500];
+thread_local uint8_t udp_buffer[65535];
+thread_local uint8_t quic_buffer[65500];
 
 const char *ToString(const sockaddr_storage &addr) {
-  static char buf[INET_ADDRSTRLEN + 6];
+  static thread_local char buf[INET_ADDRSTRLEN + 6];
   if (inet_ntop(AF_INET,
                 &reinterpret_cast<const sockaddr_in *>(&addr)->sin_addr, buf,
                 sizeof(buf))) {
@@ -7,8 +7,8 @@
 
 namespace quic_tunnel {
 
-extern uint8_t udp_buffer[65535];
-extern uint8_t quic_buffer[65500];
+extern thread_local uint8_t udp_buffer[65535];
+extern thread_local uint8_t quic_buffer[65500];
 
 template <auto T>
 using ConstantType = std::integral_constant<std::decay_t<decltype(T)>, T>;
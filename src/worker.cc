@@ -0,0 +1,53 @@
+#include "worker.h"
+
+#include <memory>
+
+#include "app_config.h"
+
+namespace quic_tunnel {
+
+void Worker::Start() {
+  thread_ = std::thread([this] {
+    if (base_.Dispatch() != 0) {
+      logger->error("worker event loop failed");
+    }
+  });
+}
+
+void Worker::Stop() {
+  if (thread_.joinable()) {
+    base_.Exit();
+    thread_.join();
+  }
+}
+
+int RunWorkers(const QuicConfig &quic_config, EventBase &base, Admin &admin) {
+  const auto &cfg = AppConfig::GetInstance();
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<QuicServer *> group;
+  for (uint32_t i = 0; i < cfg.workers; ++i) {
+    workers.emplace_back(std::make_unique<Worker>(quic_config, admin));
+    group.emplace_back(&workers.back()->quic_server());
+  }
+
+  // Sockets are indexed in the reuseport group by the order they are bound.
+  for (uint32_t i = 0; i < cfg.workers; ++i) {
+    workers[i]->quic_server().JoinGroup(group, i);
+    if (workers[i]->Bind() != 0) {
+      return -1;
+    }
+  }
+
+  for (auto &worker : workers) {
+    worker->Start();
+  }
+  logger->info("started {} workers", workers.size());
+
+  int r = base.Dispatch();
+  for (auto &worker : workers) {
+    worker->Stop();
+  }
+  return r;
+}
+
+}  // namespace quic_tunnel
@@ -0,0 +1,38 @@
+#ifndef QUIC_TUNNEL_WORKER_H_
+#define QUIC_TUNNEL_WORKER_H_
+
+#include <thread>
+#include <vector>
+
+#include "event/event_base.h"
+#include "tcp_tunnel_server.h"
+
+namespace quic_tunnel {
+
+// Runs a TcpTunnelServer with its own EventBase and UDP socket on a dedicated
+// thread.
+class Worker : NonCopyable {
+ public:
+  Worker(const QuicConfig &quic_config, Admin &admin)
+      : base_(), server_(quic_config, base_, admin), thread_() {}
+  ~Worker() { Stop(); }
+
+  QuicServer &quic_server() noexcept { return server_.quic_server(); }
+
+  int Bind() { return server_.Bind(); }
+  void Start();
+  void Stop();
+
+ private:
+  EventBase base_;
+  TcpTunnelServer server_;
+  std::thread thread_;
+};
+
+// Binds one worker per configured thread into a SO_REUSEPORT group and runs
+// them until the admin event loop exits.
+int RunWorkers(const QuicConfig &quic_config, EventBase &base, Admin &admin);
+
+}  // namespace quic_tunnel
+
+#endif  // QUIC_TUNNEL_WORKER_H_
@@ -0,0 +1,239 @@
+// Decodes the binary record files of quic-tunnel, see record_file in the
+// conf, into CSV with a header line, or JSON with one object per line.
+//
+// Usage:
+//   quic-tunnel-record-decode [--format=csv|json] FILE...
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "record.h"
+
+namespace quic_tunnel {
+namespace {
+
+const char *TypeName(const Record &record) {
+  switch (record.type) {
+    case Record::kStream:
+      return "stream";
+    case Record::kConnection:
+      return "connection";
+    default:
+      return "unknown";
+  }
+}
+
+const char *CloseReasonName(const Record &record) {
+  switch (record.close_reason) {
+    case Record::kLocalClosed:
+      return "local";
+    case Record::kRemoteClosed:
+      return "remote";
+    case Record::kConnectionClosed:
+      return "connection";
+    case Record::kHandshakeFailed:
+      return "handshake";
+    default:
+      return "unknown";
+  }
+}
+
+std::string HexCid(const Record &record) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  std::string hex;
+  const auto len = std::min<size_t>(record.cid_len, Record::kMaxCidBytes);
+  for (size_t i = 0; i < len; ++i) {
+    hex += kDigits[record.cid[i] >> 4];
+    hex += kDigits[record.cid[i] & 0xf];
+  }
+  return hex;
+}
+
+std::string_view Host(const Record &record) {
+  return {record.host,
+          std::min<size_t>(record.host_len, Record::kMaxHostBytes)};
+}
+
+void PrintCsvHeader() {
+  fputs(
+      "type,close_reason,cid,stream_id,host,start_time,end_time,recv_bytes,"
+      "sent_bytes,rtt,cwnd,lost,delivery_rate\n",
+      stdout);
+}
+
+void PrintCsv(const Record &record) {
+  const bool stream = record.type == Record::kStream;
+  printf("%s,%s,%s,", TypeName(record), CloseReasonName(record),
+         HexCid(record).c_str());
+  if (stream) {
+    printf("%lu", record.stream_id);
+  }
+  putchar(',');
+
+  const auto host = Host(record);
+  if (host.find_first_of(",\"\r\n") == std::string_view::npos) {
+    fwrite(host.data(), 1, host.size(), stdout);
+  } else {
+    putchar('"');
+    for (auto c : host) {
+      if (c == '"') {
+        putchar('"');
+      }
+      putchar(c);
+    }
+    putchar('"');
+  }
+
+  printf(",%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", record.start_time,
+         record.end_time, record.recv_bytes, record.sent_bytes, record.rtt,
+         record.cwnd, record.lost, record.delivery_rate);
+}
+
+void PrintJson(const Record &record) {
+  printf("{\"type\":\"%s\",\"close_reason\":\"%s\",\"cid\":\"%s\"",
+         TypeName(record), CloseReasonName(record), HexCid(record).c_str());
+  if (record.type == Record::kStream) {
+    printf(",\"stream_id\":%lu,\"host\":\"", record.stream_id);
+    // Bytes outside printable ASCII are escaped one by one, which keeps the
+    // output valid JSON whatever the peer sent as the host.
+    for (auto c : Host(record)) {
+      const auto byte = static_cast<uint8_t>(c);
+      if (c == '"' || c == '\\') {
+        putchar('\\');
+        putchar(c);
+      } else if (byte < 0x20 || byte >= 0x7f) {
+        printf("\\u%04x", byte);
+      } else {
+        putchar(c);
+      }
+    }
+    putchar('"');
+  }
+  printf(
+      ",\"start_time\":%lu,\"end_time\":%lu,\"recv_bytes\":%lu,"
+      "\"sent_bytes\":%lu,\"rtt\":%lu,\"cwnd\":%lu,\"lost\":%lu,"
+      "\"delivery_rate\":%lu}\n",
+      record.start_time, record.end_time, record.recv_bytes, record.sent_bytes,
+      record.rtt, record.cwnd, record.lost, record.delivery_rate);
+}
+
+// Returns the number of records, or -1 if the file is not a record file.
+ssize_t Decode(const char *path, bool json) {
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    fprintf(stderr, "failed to stat %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  const auto size = static_cast<size_t>(st.st_size);
+  if (size < sizeof(RecordFileHeader)) {
+    fprintf(stderr, "%s is not a record file\n", path);
+    close(fd);
+    return -1;
+  }
+
+  auto *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "failed to map %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  const auto *header = static_cast<const RecordFileHeader *>(data);
+  if (memcmp(header->magic, kRecordMagic, sizeof(header->magic)) != 0 ||
+      header->version != kRecordVersion ||
+      header->record_size < sizeof(Record)) {
+    fprintf(stderr, "%s is not a record file of version %u\n", path,
+            kRecordVersion);
+    munmap(data, size);
+    return -1;
+  }
+
+  // Records of a larger size carry fields added later, which are skipped.
+  const auto *begin = static_cast<const uint8_t *>(data);
+  const size_t stride = header->record_size;
+  ssize_t count{};
+  for (auto offset = sizeof(RecordFileHeader); offset + stride <= size;
+       offset += stride) {
+    Record record;
+    memcpy(&record, begin + offset, sizeof(record));
+    if (record.type == Record::kNone) {
+      break;
+    }
+
+    if (json) {
+      PrintJson(record);
+    } else {
+      PrintCsv(record);
+    }
+    ++count;
+  }
+
+  munmap(data, size);
+  return count;
+}
+
+void Usage() {
+  fputs("Usage: quic-tunnel-record-decode [--format=csv|json] FILE...\n",
+        stderr);
+}
+
+}  // namespace
+}  // namespace quic_tunnel
+
+int main(int argc, char **argv) {
+  using namespace quic_tunnel;
+  bool json = false;
+  std::vector<const char *> paths;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--format=csv") {
+      json = false;
+    } else if (arg == "--format=json") {
+      json = true;
+    } else if (arg.substr(0, 2) == "--") {
+      Usage();
+      return 1;
+    } else {
+      paths.emplace_back(argv[i]);
+    }
+  }
+
+  if (paths.empty()) {
+    Usage();
+    return 1;
+  }
+
+  static char buffer[1 << 20];
+  setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+  if (!json) {
+    PrintCsvHeader();
+  }
+
+  int r = 0;
+  for (const auto *path : paths) {
+    if (Decode(path, json) < 0) {
+      r = 1;
+    }
+  }
+  return r;
+}